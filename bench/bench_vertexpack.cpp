@@ -0,0 +1,131 @@
+// Vertex packing microbenchmark: the old per-vertex DrawMesh loop against the packing kernels.
+// Standalone, doesn't need GL or libmovie, build from this folder with e.g.
+//   cl /O2 /EHsc /I../libs/glad/include bench_vertexpack.cpp ../src/vertexpack.cpp
+//   g++ -O2 -I../libs/glad/include bench_vertexpack.cpp ../src/vertexpack.cpp -o bench_vertexpack
+#include "../src/vertexpack.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static const size_t kNumVertices    = 4 * 1024;     // a typical big mesh
+static const size_t kNumMeshes      = 256;          // meshes per "frame"
+static const size_t kNumRuns        = 50;
+
+struct Color {
+    float r, g, b;
+};
+
+// vertex layout DrawMesh used to write
+struct LegacyVertex {
+    float    pos[3];
+    float    uv0[2];
+    float    uv1[2];
+    uint32_t color;
+    uint8_t  slots[4];
+};
+
+static uint32_t FloatColorToUint(const Color& color, const float alpha) {
+    const uint32_t r = static_cast<uint32_t>(std::floor(color.r * 255.5f));
+    const uint32_t g = static_cast<uint32_t>(std::floor(color.g * 255.5f));
+    const uint32_t b = static_cast<uint32_t>(std::floor(color.b * 255.5f));
+    const uint32_t a = static_cast<uint32_t>(std::floor(alpha * 255.5f));
+
+    return (a << 24) | (b << 16) | (g << 8) | r;
+}
+
+// what Composition::DrawMesh used to do, color converted for every vertex
+static void PackVerticesReference(LegacyVertex* dst, const float* positions, const float* uv0, const float* uv1, const Color& color, const float opacity, const size_t count) {
+    for (size_t i = 0; i < count; ++i, ++dst) {
+        dst->pos[0] = positions[i * 3 + 0];
+        dst->pos[1] = positions[i * 3 + 1];
+        dst->pos[2] = positions[i * 3 + 2];
+        dst->uv0[0] = uv0[i * 2 + 0];
+        dst->uv0[1] = uv0[i * 2 + 1];
+        dst->uv1[0] = uv1[i * 2 + 0];
+        dst->uv1[1] = uv1[i * 2 + 1];
+        dst->color = FloatColorToUint(color, opacity);
+        dst->slots[0] = dst->slots[1] = dst->slots[2] = dst->slots[3] = 0;
+    }
+}
+
+template <typename T>
+static double Measure(T func) {
+    double best = 1e30;
+    for (size_t run = 0; run < kNumRuns; ++run) {
+        const auto start = std::chrono::high_resolution_clock::now();
+        func();
+        const auto end = std::chrono::high_resolution_clock::now();
+        const double ms = std::chrono::duration<double, std::milli>(end - start).count();
+        best = (ms < best) ? ms : best;
+    }
+    return best;
+}
+
+int main() {
+    std::vector<float> positions(kNumVertices * 3);
+    std::vector<float> uv0(kNumVertices * 2), uv1(kNumVertices * 2);
+    for (float& f : positions) { f = static_cast<float>(rand()) / RAND_MAX * 1024.0f; }
+    for (float& f : uv0) { f = static_cast<float>(rand()) / RAND_MAX * 2.0f - 0.5f; }
+    for (float& f : uv1) { f = static_cast<float>(rand()) / RAND_MAX; }
+
+    const Color color = { 0.25f, 0.5f, 0.75f };
+    const float opacity = 0.8f;
+
+    VertexPackSource src;
+    src.positions = positions.data();
+    src.uv = uv0.data();
+    src.drawId = 42;
+
+    std::vector<LegacyVertex> legacyArena(kNumVertices * kNumMeshes);
+    const double legacyBytes = static_cast<double>(legacyArena.size() * sizeof(LegacyVertex));
+    const double reference = Measure([&]() {
+        for (size_t m = 0; m < kNumMeshes; ++m) {
+            PackVerticesReference(legacyArena.data() + m * kNumVertices, positions.data(), uv0.data(), uv1.data(), color, opacity, kNumVertices);
+        }
+    });
+
+    printf("%u meshes x %u vertices, best of %u runs\n", static_cast<unsigned>(kNumMeshes), static_cast<unsigned>(kNumVertices), static_cast<unsigned>(kNumRuns));
+    printf("%-10s %8.3f ms  %6.2f GB/s  (%u byte vertices)\n", "reference", reference, legacyBytes / (reference * 1e6), static_cast<unsigned>(sizeof(LegacyVertex)));
+
+    // rects are computed per mesh, so they're part of the packing cost
+    std::vector<DrawVertex> expected(kNumVertices), arena(kNumVertices * kNumMeshes);
+    CalcUVRect(src.uv, kNumVertices, src.uvRect);
+    GetVertexPackFunc(VertexPackKernel::Scalar)(expected.data(), src, kNumVertices);
+
+    const double bytes = static_cast<double>(arena.size() * sizeof(DrawVertex));
+
+    int result = 0;
+    for (size_t k = 0; k < static_cast<size_t>(VertexPackKernel::Count); ++k) {
+        const VertexPackKernel kernel = static_cast<VertexPackKernel>(k);
+        const VertexPackFunc func = GetVertexPackFunc(kernel);
+        if (!func) {
+            printf("%-10s not supported\n", GetVertexPackKernelName(kernel));
+            continue;
+        }
+
+        const double ms = Measure([&]() {
+            for (size_t m = 0; m < kNumMeshes; ++m) {
+                VertexPackSource meshSrc = src;
+                CalcUVRect(meshSrc.uv, kNumVertices, meshSrc.uvRect);
+                func(arena.data() + m * kNumVertices, meshSrc, kNumVertices);
+            }
+        });
+
+        // odd counts exercise the tails
+        memset(arena.data(), 0, kNumVertices * sizeof(DrawVertex));
+        func(arena.data(), src, kNumVertices - 3);
+        const bool valid = (memcmp(arena.data(), expected.data(), (kNumVertices - 3) * sizeof(DrawVertex)) == 0);
+        if (!valid) {
+            result = 1;
+        }
+
+        printf("%-10s %8.3f ms  %6.2f GB/s  x%.2f%s%s\n", GetVertexPackKernelName(kernel), ms, bytes / (ms * 1e6), reference / ms,
+               (kernel == GetVertexPackKernel()) ? "  (used)" : "", valid ? "" : "  MISMATCH");
+    }
+
+    return result;
+}
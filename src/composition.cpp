@@ -1,8 +1,12 @@
 #include "composition.h"
 #include "movie_resmgr.h"
+#include "shadercache.h"
+#include "glstatecache.h"
 
 #include "simplemath.h"
 
+#include <algorithm>
+
 extern "C" {
 #include <movie/movie.h>
 }
@@ -11,94 +15,285 @@ extern "C" {
 #define _GL_OFFSET(s, m) reinterpret_cast<const GLvoid*>(&(((s*)0)->m))
 
 
-static const size_t kMaxVerticesToDraw  = 4 * 1024;
-static const size_t kMaxIndicesToDraw   = 6 * 1024;
+// initial stream segment sizes, segments grow when a frame needs more
+static const size_t kStreamSegmentVertices  = 64 * 1024;
+static const size_t kStreamSegmentIndices   = 96 * 1024;
+
+// single record is drawn with indices relative to its first vertex, 32-bit ones once it
+// goes over 64K vertices, bigger meshes are split
+static const size_t kMaxRecordVertices  = 256 * 1024;
+static const size_t kMaxRecordIndices   = 768 * 1024;
 
 static const float  kSomeSmallFloat = 0.000001f;
 
-struct DrawVertex {
-    float    pos[3];
-    float    uv0[2];
-    float    uv1[2];
-    uint32_t color;
-};
+// upper limit for the samplers we put into a single multi-texture batch
+static const size_t kMaxBatchTextures = 32;
+
+static const GLuint kVertexPosAttribIdx    = 0;
+static const GLuint kVertexUVAttribIdx     = 1;
+static const GLuint kVertexDrawIdAttribIdx = 2;
+// per-instance ones, DrawInstance fields in order
+static const GLuint kInstanceAffineXAttribIdx = 3;
+static const GLuint kInstanceAffineYAttribIdx = 4;
+static const GLuint kInstanceUVRectAttribIdx  = 5;
+static const GLuint kInstanceColorAttribIdx   = 6;
+static const GLuint kInstanceSlotAttribIdx    = 7;
 
-static const GLuint kVertexPosAttribIdx   = 0;
-static const GLuint kVertexUV0AttribIdx   = 1;
-static const GLuint kVertexUV1AttribIdx   = 2;
-static const GLuint kVertexColorAttribIdx = 3;
+static const size_t kStreamSegmentInstances = 4 * 1024;
+
+// DrawData is read from a RGBA32F buffer texture, one texel per vec4
+static_assert(sizeof(DrawData) == 4 * 4 * sizeof(float), "shaders expect DrawData to be 4 texels");
 
 static const GLint  kTextureRGBSlot = 0;
 static const GLint  kTextureASlot   = 1;
 
+static const GLuint kViewParamsBinding = 0;
+
+// mirrors the std140 layout of the ViewParams uniform block
+struct ViewParams {
+    float   wvp[16];
+    float   offset[2];
+    float   scale;
+    float   wireMode;   // 0: off, 1: edges over the fill, 2: edges only
+};
+
 
-static const char* sVertexShader = "#version 330       \n\
-layout(location = 0) in vec3 inPos;                    \n\
-layout(location = 1) in vec2 inUV0;                    \n\
-layout(location = 2) in vec2 inUV1;                    \n\
-layout(location = 3) in vec4 inColor;                  \n\
-uniform mat4 uWVP;                                     \n\
-uniform float uScale;                                  \n\
-uniform vec2 uOffset;                                  \n\
+// uvs come in as unorm16 within the draw's uv rect, everything per-draw is in uDrawData:
+// color, uv rect, rgb uv affine + texture slots
+// compiled with the same defines as the fragment shader, with HAS_MATTE the vertex uv
+// goes to the matte and the rgb uv is made from the position
+// INSTANCED takes the per-draw values from the instance attributes instead and makes the position
+// from the vertex uv through the instance affine, it's never combined with HAS_MATTE or WIREFRAME
+// WIREFRAME is for the wire modes, every triangle has its own vertices with the corner in the top
+// bits of the draw id (see DrawList::kWireCornerShift), that gives the barycentrics the fragment
+// shader draws the edges with, w of them is how much of the fill shows
+// the rgb slot carries the draw flags above its 8 bits (see DrawList::kDrawFlagStraightAlpha),
+// with UNIFIED_BLEND they go to the fragment shader as v2fBlend
+static const char* sVertexShader = "                   \n\
+layout(location = 0) in vec2 inPos;                    \n\
+layout(location = 1) in vec2 inUV;                     \n\
+#ifdef INSTANCED                                       \n\
+layout(location = 3) in vec3 inAffineX;                \n\
+layout(location = 4) in vec3 inAffineY;                \n\
+layout(location = 5) in vec4 inUVRect;                 \n\
+layout(location = 6) in vec4 inColor;                  \n\
+layout(location = 7) in uint inSlot;                   \n\
+#else                                                  \n\
+layout(location = 2) in uint inDrawId;                 \n\
+uniform samplerBuffer uDrawData;                       \n\
+#endif                                                 \n\
+layout(std140) uniform ViewParams {                    \n\
+    mat4 uWVP;                                         \n\
+    vec2 uOffset;                                      \n\
+    float uScale;                                      \n\
+    float uWireMode;                                   \n\
+};                                                     \n\
 out vec2 v2fUV0;                                       \n\
+#ifdef HAS_MATTE                                       \n\
 out vec2 v2fUV1;                                       \n\
+#endif                                                 \n\
 out vec4 v2fColor;                                     \n\
+#ifdef WIREFRAME                                       \n\
+noperspective out vec4 v2fBary;                        \n\
+#endif                                                 \n\
+flat out uvec2 v2fSlots;                               \n\
+#ifdef UNIFIED_BLEND                                   \n\
+flat out vec2 v2fBlend;                                \n\
+#endif                                                 \n\
 void main() {                                          \n\
-    vec3 p = inPos * uScale + vec3(uOffset, 0.0);      \n\
-    gl_Position = uWVP * vec4(p, 1.0);                 \n\
-    v2fUV0 = inUV0;                                    \n\
-    v2fUV1 = inUV1;                                    \n\
+#ifdef INSTANCED                                       \n\
+    vec3 local = vec3(1.0, inUV);                      \n\
+    vec2 pos = vec2(dot(inAffineX, local), dot(inAffineY, local)); \n\
+    vec4 uvRect = inUVRect;                            \n\
     v2fColor = inColor;                                \n\
+    uint slotRGB = inSlot;                             \n\
+    v2fSlots = uvec2(slotRGB & 0xFFu, 0u);             \n\
+#else                                                  \n\
+    int base = int(inDrawId & 0x3FFFFFFFu) * 4;        \n\
+#ifdef WIREFRAME                                       \n\
+    uint corner = inDrawId >> 30u;                     \n\
+    v2fBary.xyz = vec3(equal(uvec3(corner), uvec3(0u, 1u, 2u))); \n\
+    v2fBary.w = uWireMode > 1.5 ? 0.0 : 1.0;           \n\
+#endif                                                 \n\
+    vec4 uvRect = texelFetch(uDrawData, base + 1);     \n\
+    vec4 affineU = texelFetch(uDrawData, base + 2);    \n\
+    vec4 affineV = texelFetch(uDrawData, base + 3);    \n\
+    vec2 pos = inPos;                                  \n\
+    v2fColor = texelFetch(uDrawData, base);            \n\
+    uint slotRGB = uint(affineU.w);                    \n\
+    v2fSlots = uvec2(slotRGB & 0xFFu, uint(affineV.w)); \n\
+#endif                                                 \n\
+#ifdef UNIFIED_BLEND                                   \n\
+    v2fBlend = vec2(float((slotRGB >> 8u) & 1u), float(((slotRGB >> 9u) & 1u) ^ 1u)); \n\
+#endif                                                 \n\
+    vec2 p = pos * uScale + uOffset;                   \n\
+    gl_Position = uWVP * vec4(p, 0.0, 1.0);            \n\
+    vec2 uv = uvRect.xy + inUV * uvRect.zw;            \n\
+#ifdef HAS_MATTE                                       \n\
+    vec3 matte = vec3(1.0, pos);                       \n\
+    v2fUV0 = vec2(dot(affineU.xyz, matte), dot(affineV.xyz, matte)); \n\
+    v2fUV1 = uv;                                       \n\
+#else                                                  \n\
+    v2fUV0 = uv;                                       \n\
+#endif                                                 \n\
 }                                                      \n";
 
-static const char* sFragmentShader = "#version 330     \n\
+// fragment shaders are compiled in permutations, MakeFragmentShader prepends the #version and the defines:
+//  HAS_TEXTURE   - sample uTextureRGB, otherwise it's a solid color fill
+//  HAS_MATTE     - sample track matte alpha from uTextureA
+//  PREMULT_ALPHA - texture has premultiplied alpha
+//  UNIFIED_BLEND - output is always premultiplied, v2fBlend.x says if the texture still needs it,
+//                  v2fBlend.y is 0 for additive draws, so one blend func does Normal & Add
+//  WIREFRAME     - edges from the barycentrics are blended in last, with the vertex color in the same
+//                  alpha form as the fill, so the wire modes need no extra pass, Solid draws use the
+//                  permutations without it
+static const char* sFragmentShader = "                 \n\
+#ifdef HAS_TEXTURE                                     \n\
 uniform sampler2D uTextureRGB;                         \n\
+#endif                                                 \n\
+#ifdef HAS_MATTE                                       \n\
 uniform sampler2D uTextureA;                           \n\
-uniform bool uIsPremultAlpha;                          \n\
+#endif                                                 \n\
 in vec2 v2fUV0;                                        \n\
+#ifdef HAS_MATTE                                       \n\
 in vec2 v2fUV1;                                        \n\
+#endif                                                 \n\
 in vec4 v2fColor;                                      \n\
+#ifdef WIREFRAME                                       \n\
+noperspective in vec4 v2fBary;                         \n\
+#endif                                                 \n\
+#ifdef UNIFIED_BLEND                                   \n\
+flat in vec2 v2fBlend;                                 \n\
+#endif                                                 \n\
 out vec4 oColor;                                       \n\
 void main() {                                          \n\
-    vec4 texColor = texture(uTextureRGB, v2fUV0);      \n\
-    vec4 texAlpha = texture(uTextureA, v2fUV1);        \n\
-    oColor = texColor * v2fColor;                      \n\
-    if (uIsPremultAlpha) {                             \n\
-        oColor.rgb *= texAlpha.a * v2fColor.a;         \n\
-        oColor.a *= texAlpha.a;                        \n\
-    } else {                                           \n\
-        oColor.a *= texAlpha.a * v2fColor.a;           \n\
-    }                                                  \n\
-}                                                      \n";
-
-static const char* sWireVertexShader = "#version 330   \n\
-layout(location = 0) in vec3 inPos;                    \n\
-layout(location = 3) in vec4 inColor;                  \n\
-uniform mat4 uWVP;                                     \n\
-uniform float uScale;                                  \n\
-uniform vec2 uOffset;                                  \n\
-out vec4 v2fColor;                                     \n\
-void main() {                                          \n\
-    vec3 p = inPos * uScale + vec3(uOffset, 0.0);      \n\
-    gl_Position = uWVP * vec4(p, 1.0);                 \n\
-    v2fColor = inColor;                                \n\
+#ifdef HAS_TEXTURE                                     \n\
+    oColor = texture(uTextureRGB, v2fUV0) * v2fColor;  \n\
+#else                                                  \n\
+    oColor = v2fColor;                                 \n\
+#endif                                                 \n\
+#ifdef HAS_MATTE                                       \n\
+    float matte = texture(uTextureA, v2fUV1).a;        \n\
+#else                                                  \n\
+    float matte = 1.0;                                 \n\
+#endif                                                 \n\
+#if defined(UNIFIED_BLEND)                             \n\
+    float alpha = oColor.a * matte;                    \n\
+    oColor.rgb *= matte * mix(v2fColor.a, oColor.a, v2fBlend.x); \n\
+    oColor.a = alpha * v2fBlend.y;                     \n\
+#elif defined(PREMULT_ALPHA)                           \n\
+    oColor.rgb *= matte * v2fColor.a;                  \n\
+    oColor.a *= matte;                                 \n\
+#else                                                  \n\
+    oColor.a *= matte * v2fColor.a;                    \n\
+#endif                                                 \n\
+#ifdef WIREFRAME                                       \n\
+#if defined(UNIFIED_BLEND)                             \n\
+    vec4 edgeColor = vec4(v2fColor.rgb * v2fColor.a, v2fColor.a * v2fBlend.y); \n\
+#elif defined(PREMULT_ALPHA)                           \n\
+    vec4 edgeColor = vec4(v2fColor.rgb * v2fColor.a, v2fColor.a); \n\
+#else                                                  \n\
+    vec4 edgeColor = v2fColor;                         \n\
+#endif                                                 \n\
+    vec3 edges = v2fBary.xyz / max(fwidth(v2fBary.xyz) * 1.5, vec3(0.000001)); \n\
+    float edge = 1.0 - clamp(min(min(edges.x, edges.y), edges.z), 0.0, 1.0); \n\
+    oColor = mix(oColor * v2fBary.w, edgeColor, edge); \n\
+#endif                                                 \n\
 }                                                      \n";
 
-static const char* sWireFragmentShader = "#version 330 \n\
+// multi-texture variant, the sampler is picked by the per-vertex slot index
+// GLSL 3.30 only allows constant indices into sampler arrays, so we unroll the selection
+// and use explicit gradients as implicit ones are undefined inside non-uniform branches
+// always textured (solid meshes use the white texture), HAS_MATTE, PREMULT_ALPHA, UNIFIED_BLEND & WIREFRAME work as above
+static const char* sMultiFragmentShaderHead = "        \n\
+in vec2 v2fUV0;                                        \n\
+#ifdef HAS_MATTE                                       \n\
+in vec2 v2fUV1;                                        \n\
+#endif                                                 \n\
 in vec4 v2fColor;                                      \n\
-out vec4 oColor;                                       \n\
+#ifdef WIREFRAME                                       \n\
+noperspective in vec4 v2fBary;                         \n\
+#endif                                                 \n\
+flat in uvec2 v2fSlots;                                \n\
+#ifdef UNIFIED_BLEND                                   \n\
+flat in vec2 v2fBlend;                                 \n\
+#endif                                                 \n\
+out vec4 oColor;                                       \n";
+
+static const char* sMultiFragmentShaderMain = "         \n\
 void main() {                                          \n\
-    oColor = v2fColor;                                 \n\
+    oColor = SampleSlot(v2fSlots.x, v2fUV0, dFdx(v2fUV0), dFdy(v2fUV0)) * v2fColor; \n\
+#ifdef HAS_MATTE                                       \n\
+    float matte = SampleSlot(v2fSlots.y, v2fUV1, dFdx(v2fUV1), dFdy(v2fUV1)).a; \n\
+#else                                                  \n\
+    float matte = 1.0;                                 \n\
+#endif                                                 \n\
+#if defined(UNIFIED_BLEND)                             \n\
+    float alpha = oColor.a * matte;                    \n\
+    oColor.rgb *= matte * mix(v2fColor.a, oColor.a, v2fBlend.x); \n\
+    oColor.a = alpha * v2fBlend.y;                     \n\
+#elif defined(PREMULT_ALPHA)                           \n\
+    oColor.rgb *= matte * v2fColor.a;                  \n\
+    oColor.a *= matte;                                 \n\
+#else                                                  \n\
+    oColor.a *= matte * v2fColor.a;                    \n\
+#endif                                                 \n\
+#ifdef WIREFRAME                                       \n\
+#if defined(UNIFIED_BLEND)                             \n\
+    vec4 edgeColor = vec4(v2fColor.rgb * v2fColor.a, v2fColor.a * v2fBlend.y); \n\
+#elif defined(PREMULT_ALPHA)                           \n\
+    vec4 edgeColor = vec4(v2fColor.rgb * v2fColor.a, v2fColor.a); \n\
+#else                                                  \n\
+    vec4 edgeColor = v2fColor;                         \n\
+#endif                                                 \n\
+    vec3 edges = v2fBary.xyz / max(fwidth(v2fBary.xyz) * 1.5, vec3(0.000001)); \n\
+    float edge = 1.0 - clamp(min(min(edges.x, edges.y), edges.z), 0.0, 1.0); \n\
+    oColor = mix(oColor * v2fBary.w, edgeColor, edge); \n\
+#endif                                                 \n\
 }                                                      \n";
 
+static std::string MakeShaderDefines(const DrawList::Shading shading, const DrawList::AlphaMode alphaMode, const bool wireframe) {
+    std::string defines = "#version 330\n";
+    if (shading != DrawList::Shading::Solid) {
+        defines += "#define HAS_TEXTURE\n";
+    }
+    if (shading == DrawList::Shading::TextureMatte) {
+        defines += "#define HAS_MATTE\n";
+    }
+    if (alphaMode == DrawList::AlphaMode::Premultiplied) {
+        defines += "#define PREMULT_ALPHA\n";
+    } else if (alphaMode == DrawList::AlphaMode::Unified) {
+        defines += "#define UNIFIED_BLEND\n";
+    }
+    if (wireframe) {
+        defines += "#define WIREFRAME\n";
+    }
+    return defines;
+}
 
-static uint32_t FloatColorToUint(ae_color_t color, ae_color_channel_t alpha) {
-    const uint32_t r = static_cast<uint32_t>(std::floorf(color.r * 255.5f));
-    const uint32_t g = static_cast<uint32_t>(std::floorf(color.g * 255.5f));
-    const uint32_t b = static_cast<uint32_t>(std::floorf(color.b * 255.5f));
-    const uint32_t a = static_cast<uint32_t>(std::floorf(alpha * 255.5f));
+static std::string MakeVertexShader(const DrawList::Shading shading, const DrawList::AlphaMode alphaMode, const bool instanced, const bool wireframe) {
+    return MakeShaderDefines(shading, alphaMode, wireframe) + (instanced ? "#define INSTANCED\n" : "") + sVertexShader;
+}
 
-    return (a << 24) | (b << 16) | (g << 8) | r;
+static std::string MakeFragmentShader(const DrawList::Shading shading, const DrawList::AlphaMode alphaMode, const bool wireframe) {
+    return MakeShaderDefines(shading, alphaMode, wireframe) + sFragmentShader;
+}
+
+static std::string MakeMultiFragmentShader(const size_t numTextures, const DrawList::Shading shading, const DrawList::AlphaMode alphaMode, const bool wireframe) {
+    std::string src = MakeShaderDefines(shading, alphaMode, wireframe) + sMultiFragmentShaderHead;
+
+    src += "uniform sampler2D uTextures[" + std::to_string(numTextures) + "];\n";
+    src += "vec4 SampleSlot(uint slot, vec2 uv, vec2 dx, vec2 dy) {\n";
+    for (size_t i = 0; i < numTextures; ++i) {
+        const std::string idx = std::to_string(i);
+        src += "    if (slot == " + idx + "u) return textureGrad(uTextures[" + idx + "], uv, dx, dy);\n";
+    }
+    src += "    return vec4(1.0);\n";
+    src += "}\n";
+
+    src += sMultiFragmentShaderMain;
+
+    return src;
 }
 
 struct TrackMatteDesc {
@@ -107,25 +302,42 @@ struct TrackMatteDesc {
     ae_track_matte_mode_t mode;
 };
 
+// what OnProvideNode gives every drawn layer, its address keys the layer in the GeometryCache
+struct LayerNode {
+    ResourceImage* trackMatteImage;
+};
+
 
 Composition::Composition()
     : mComposition(nullptr)
     // rendering stuff
-    , mShader(0)
-    , mWireShader(0)
+    , mPrograms{}
+    , mMultiPrograms{}
+    , mInstancedPrograms{}
+    , mInstancedMultiPrograms{}
+    , mWirePrograms{}
+    , mWireMultiPrograms{}
     , mVAO(0)
-    , mVB(0)
-    , mIB(0)
-    , mCurrentTextureRGB(0)
-    , mCurrentTextureA(0)
-    , mCurrentBlendMode(BlendMode::Normal)
-    , mPremultipliedAlpha(false)
-    , mNumVertices(0)
-    , mNumIndices(0)
-    , mVerticesData(nullptr)
-    , mIndicesData(nullptr)
+    , mResidentVAO(0)
+    , mResidentBuffer(0)
+    , mResidentCapacity(0)
+    , mInstanceVAO(0)
+    , mDrawDataBuffer(0)
+    , mDrawDataTexture(0)
+    , mDrawDataSlot(0)
+    , mViewParamsUBO(0)
+    , mViewParamsDirty(true)
+    , mViewParamsMode(DrawMode::Solid)
+    , mMultiTextureBatching(true)
+    , mMaxBatchTextures(2)
+    , mDrawReordering(false)
+    , mParallelPacking(true)
+    , mGeometryCaching(true)
+    , mInstancing(true)
+    , mViewportCulling(true)
+    , mUnifiedBlending(false)
     //
-    , mDrawMode(DrawMode::Solid)
+    , mDrawStats()
     , mViewportWidth(1.0f)
     , mViewportHeight(1.0f)
     , mContentScale(1.0f)
@@ -144,81 +356,97 @@ Composition::~Composition() {
 }
 
 void Composition::SetViewportSize(const float width, const float height) {
-    mViewportWidth = width < kSomeSmallFloat ? kSomeSmallFloat : width;
-    mViewportHeight = height < kSomeSmallFloat ? kSomeSmallFloat : height;
-
-    const float left = 0.0f;
-    const float right = mViewportWidth;
-    const float bottom = mViewportHeight;
-    const float top = 0.0f;
-    const float zNear = -1.0f;
-    const float zFar = 1.0f;
+    const float newWidth = width < kSomeSmallFloat ? kSomeSmallFloat : width;
+    const float newHeight = height < kSomeSmallFloat ? kSomeSmallFloat : height;
 
-    float projOrtho[16];
-    MakeOrtho2DMat(left, right, top, bottom, zNear, zFar, projOrtho);
+    if (newWidth != mViewportWidth || newHeight != mViewportHeight) {
+        mViewportWidth = newWidth;
+        mViewportHeight = newHeight;
+        mViewParamsDirty = true;
+    }
+}
 
-    if (mShader) {
-        glUseProgram(mShader);
-        GLint mvpLoc = glGetUniformLocation(mShader, "uWVP");
-        if (mvpLoc >= 0) {
-            glUniformMatrix4fv(mvpLoc, 1, GL_FALSE, projOrtho);
-        }
+void Composition::SetContentScale(const float scale) {
+    const float newScale = scale < kSomeSmallFloat ? kSomeSmallFloat : scale;
 
+    if (newScale != mContentScale) {
+        mContentScale = newScale;
+        mViewParamsDirty = true;
     }
+}
 
-    if (mWireShader) {
-        glUseProgram(mWireShader);
-        GLint mvpLoc = glGetUniformLocation(mWireShader, "uWVP");
-        if (mvpLoc >= 0) {
-            glUniformMatrix4fv(mvpLoc, 1, GL_FALSE, projOrtho);
-        }
-    }
+float Composition::GetContentScale() const {
+    return mContentScale;
 }
 
-void Composition::SetContentScale(const float scale) {
-    mContentScale = scale < kSomeSmallFloat ? kSomeSmallFloat : scale;
+void Composition::SetMultiTextureBatching(const bool enable) {
+    mMultiTextureBatching = enable && this->HasMultiPrograms();
+}
 
-    if (mShader) {
-        glUseProgram(mShader);
-        GLint scaleLoc = glGetUniformLocation(mShader, "uScale");
-        if (scaleLoc >= 0) {
-            glUniform1f(scaleLoc, mContentScale);
-        }
+bool Composition::IsMultiTextureBatching() const {
+    return mMultiTextureBatching;
+}
 
-    }
+size_t Composition::GetMaxBatchTextures() const {
+    return mMaxBatchTextures;
+}
 
-    if (mWireShader) {
-        glUseProgram(mWireShader);
-        GLint scaleLoc = glGetUniformLocation(mWireShader, "uScale");
-        if (scaleLoc >= 0) {
-            glUniform1f(scaleLoc, mContentScale);
-        }
-    }
+void Composition::SetDrawReordering(const bool enable) {
+    mDrawReordering = enable;
 }
 
-float Composition::GetContentScale() const {
-    return mContentScale;
+bool Composition::IsDrawReordering() const {
+    return mDrawReordering;
 }
 
-void Composition::SetContentOffset(const float offX, const float offY) {
-    mContentOffX = offX;
-    mContentOffY = offY;
-
-    if (mShader) {
-        glUseProgram(mShader);
-        GLint offLoc = glGetUniformLocation(mShader, "uOffset");
-        if (offLoc >= 0) {
-            glUniform2f(offLoc, mContentOffX, mContentOffY);
-        }
+void Composition::SetParallelPacking(const bool enable) {
+    mParallelPacking = enable;
+}
 
+bool Composition::IsParallelPacking() const {
+    return mParallelPacking;
+}
+
+void Composition::SetGeometryCaching(const bool enable) {
+    if (!enable) {
+        mGeometryCache.Clear();
     }
+    mGeometryCaching = enable;
+}
 
-    if (mWireShader) {
-        glUseProgram(mWireShader);
-        GLint offLoc = glGetUniformLocation(mWireShader, "uOffset");
-        if (offLoc >= 0) {
-            glUniform2f(offLoc, mContentOffX, mContentOffY);
-        }
+bool Composition::IsGeometryCaching() const {
+    return mGeometryCaching;
+}
+
+void Composition::SetInstancing(const bool enable) {
+    mInstancing = enable && this->HasInstancedPrograms();
+}
+
+bool Composition::IsInstancing() const {
+    return mInstancing;
+}
+
+void Composition::SetViewportCulling(const bool enable) {
+    mViewportCulling = enable;
+}
+
+bool Composition::IsViewportCulling() const {
+    return mViewportCulling;
+}
+
+void Composition::SetUnifiedBlending(const bool enable) {
+    mUnifiedBlending = enable && this->HasUnifiedPrograms();
+}
+
+bool Composition::IsUnifiedBlending() const {
+    return mUnifiedBlending;
+}
+
+void Composition::SetContentOffset(const float offX, const float offY) {
+    if (offX != mContentOffX || offY != mContentOffY) {
+        mContentOffX = offX;
+        mContentOffY = offY;
+        mViewParamsDirty = true;
     }
 }
 
@@ -343,69 +571,231 @@ void Composition::Update(const float deltaTime) {
 }
 
 void Composition::Draw(const DrawMode mode) {
-    static float alternativeUV[1024];
-
     if (mComposition) {
-        mDrawMode = mode;
-
-        this->BeginDraw();
-
-        ae_uint32_t render_mesh_it = 0;
-        aeMovieRenderMesh render_mesh;
-
-        while (ae_compute_movie_mesh(mComposition, &render_mesh_it, &render_mesh) == AE_TRUE) {
-            if (render_mesh.track_matte_data == AE_NULL) {
-                switch (render_mesh.layer_type) {
-                    case AE_MOVIE_LAYER_TYPE_SHAPE:
-                    case AE_MOVIE_LAYER_TYPE_SOLID: {
-                        if (render_mesh.vertexCount && render_mesh.indexCount) {
-                            this->DrawMesh(&render_mesh, nullptr, nullptr, nullptr);
-                        }
-
-                    } break;
-
-                    case AE_MOVIE_LAYER_TYPE_SEQUENCE:
-                    case AE_MOVIE_LAYER_TYPE_IMAGE: {
-                        if (render_mesh.vertexCount && render_mesh.indexCount) {
-                            ResourceImage* imageRes = reinterpret_cast<ResourceImage*>(render_mesh.resource_data);
-                            this->DrawMesh(&render_mesh, imageRes, nullptr, nullptr);
-                        }
-                    } break;
-                }
-            } else {
-                switch (render_mesh.layer_type) {
-                    case AE_MOVIE_LAYER_TYPE_SEQUENCE:
-                    case AE_MOVIE_LAYER_TYPE_IMAGE: {
-                        if (render_mesh.element_data && render_mesh.vertexCount) {
-                            const TrackMatteDesc* track_matte_desc = reinterpret_cast<const TrackMatteDesc*>(render_mesh.track_matte_data);
-                            const aeMovieRenderMesh& track_matte_mesh = track_matte_desc->mesh;
-
-                            ResourceImage* matteImageRes = reinterpret_cast<ResourceImage*>(render_mesh.element_data);
-                            ResourceImage* imageRes = reinterpret_cast<ResourceImage*>(render_mesh.resource_data);
-
-                            for (ae_uint32_t i = 0; i != track_matte_mesh.vertexCount; ++i) {
-                                const float* mesh_position = track_matte_mesh.position[i];
-
-                                CalcPointUV(&alternativeUV[i * 2],
-                                            render_mesh.position[0],
-                                            render_mesh.position[1],
-                                            render_mesh.position[2],
-                                            render_mesh.uv[0],
-                                            render_mesh.uv[1],
-                                            render_mesh.uv[2],
-                                            mesh_position);
-                            }
-
-                            this->DrawMesh(&track_matte_mesh, matteImageRes, imageRes, alternativeUV);
-                        }
-
-                    } break;
-                }
+        this->BuildCommandList(mDrawList, mode);
+        this->Submit(mDrawList, mode);
+    }
+}
+
+const Composition::DrawStats& Composition::GetDrawStats() const {
+    return mDrawStats;
+}
+
+void Composition::BuildCommandList(DrawList& drawList, const DrawMode mode) {
+    // wire lists give every triangle its own vertices, so nothing is resident or instanced then
+    const bool wireframe = (mode != DrawMode::Solid);
+
+    GeometryCache* cache = nullptr;
+    if (mGeometryCaching && !wireframe) {
+        mGeometryCache.BeginFrame();
+        cache = &mGeometryCache;
+    }
+
+    drawList.Reset(mMultiTextureBatching, mMaxBatchTextures, kMaxRecordVertices, kMaxRecordIndices, mDrawReordering, mParallelPacking, cache, mInstancing);
+    drawList.SetWireframe(wireframe);
+    drawList.SetUnifiedBlend(mUnifiedBlending);
+
+    if (mViewportCulling) {
+        // viewport in composition space, a pixel wider on each side to stay conservative
+        const float invScale = 1.0f / std::max(mContentScale, kSomeSmallFloat);
+        DrawList::Bounds visible;
+        visible.minX = (0.0f - mContentOffX) * invScale - invScale;
+        visible.minY = (0.0f - mContentOffY) * invScale - invScale;
+        visible.maxX = (mViewportWidth - mContentOffX) * invScale + invScale;
+        visible.maxY = (mViewportHeight - mContentOffY) * invScale + invScale;
+        drawList.SetCullBounds(visible);
+    }
+
+    if (!mComposition) {
+        return;
+    }
+
+    ae_uint32_t render_mesh_it = 0;
+    aeMovieRenderMesh render_mesh;
+
+    while (ae_compute_movie_mesh(mComposition, &render_mesh_it, &render_mesh) == AE_TRUE) {
+        if (render_mesh.track_matte_data == AE_NULL) {
+            switch (render_mesh.layer_type) {
+                case AE_MOVIE_LAYER_TYPE_SHAPE:
+                case AE_MOVIE_LAYER_TYPE_SOLID: {
+                    if (render_mesh.vertexCount && render_mesh.indexCount) {
+                        this->AddMesh(drawList, &render_mesh, render_mesh.element_data, nullptr, nullptr, nullptr);
+                    }
+
+                } break;
+
+                case AE_MOVIE_LAYER_TYPE_SEQUENCE:
+                case AE_MOVIE_LAYER_TYPE_IMAGE: {
+                    if (render_mesh.vertexCount && render_mesh.indexCount) {
+                        ResourceImage* imageRes = reinterpret_cast<ResourceImage*>(render_mesh.resource_data);
+                        this->AddMesh(drawList, &render_mesh, render_mesh.element_data, imageRes, nullptr, nullptr);
+                    }
+                } break;
+            }
+        } else {
+            switch (render_mesh.layer_type) {
+                case AE_MOVIE_LAYER_TYPE_SEQUENCE:
+                case AE_MOVIE_LAYER_TYPE_IMAGE: {
+                    const LayerNode* node = reinterpret_cast<const LayerNode*>(render_mesh.element_data);
+                    if (node && node->trackMatteImage && render_mesh.vertexCount) {
+                        const TrackMatteDesc* track_matte_desc = reinterpret_cast<const TrackMatteDesc*>(render_mesh.track_matte_data);
+                        const aeMovieRenderMesh& track_matte_mesh = track_matte_desc->mesh;
+
+                        ResourceImage* matteImageRes = node->trackMatteImage;
+                        ResourceImage* imageRes = reinterpret_cast<ResourceImage*>(render_mesh.resource_data);
+
+                        // the shader maps matte positions into the image uvs with it
+                        float uvAffine[6];
+                        CalcUVAffine(uvAffine,
+                                     render_mesh.position[0],
+                                     render_mesh.position[1],
+                                     render_mesh.position[2],
+                                     render_mesh.uv[0],
+                                     render_mesh.uv[1],
+                                     render_mesh.uv[2]);
+
+                        this->AddMesh(drawList, &track_matte_mesh, node, matteImageRes, imageRes, uvAffine);
+                    }
+
+                } break;
             }
         }
+    }
+
+    drawList.Finish();
+}
+
+void Composition::Submit(const DrawList& drawList, const DrawMode mode) {
+    const std::vector<DrawVertex>& vertices = drawList.GetVertices();
+    const std::vector<uint16_t>& narrowIndices = drawList.GetNarrowIndices();
+    const std::vector<uint32_t>& wideIndices = drawList.GetWideIndices();
+    const std::vector<DrawList::Record>& records = drawList.GetRecords();
+    const std::vector<GLuint>& textures = drawList.GetTextures();
+    const std::vector<DrawInstance>& instances = drawList.GetInstances();
+
+    GeometryCache* cache = drawList.GetGeometryCache();
+    // the cache has moved on to a newer list, compaction may have given this one's ranges away
+    if (cache && drawList.GetCacheFrameIdx() != cache->GetFrameIdx()) {
+        return;
+    }
+
+    mDrawStats.numMeshes = drawList.GetNumMeshes();
+    mDrawStats.numReorderedMeshes = drawList.GetNumReorderedMeshes();
+    mDrawStats.numInstancedMeshes = drawList.GetNumInstancedMeshes();
+    mDrawStats.numCulledMeshes = drawList.GetNumCulledMeshes();
+    mDrawStats.numInvisibleMeshes = drawList.GetNumInvisibleMeshes();
+    mDrawStats.numDrawCalls = 0;
+    mDrawStats.uploadedBytes = 0;
+    mDrawStats.reusedBytes = cache ? cache->GetStats().reusedBytes : 0;
+
+    // the cache already counts these layers as uploaded, so this can't wait for a frame with records
+    if (cache) {
+        mDrawStats.uploadedBytes += this->UploadResidentGeometry(*cache);
+        cache->ClearUploads();
+    }
+
+    if (records.empty()) {
+        return;
+    }
 
-        this->EndDraw();
+    // a list without the corners can only be drawn filled
+    const DrawMode viewMode = drawList.IsWireframe() ? mode : DrawMode::Solid;
+    if (viewMode != mViewParamsMode) {
+        mViewParamsMode = viewMode;
+        mViewParamsDirty = true;
     }
+
+    GLStateCache& stateCache = GLStateCache::Instance();
+
+    const size_t vbSize = vertices.size() * sizeof(DrawVertex);
+    const size_t narrowIBSize = narrowIndices.size() * sizeof(uint16_t);
+    const size_t wideIBSize = wideIndices.size() * sizeof(uint32_t);
+    // wide indices follow the narrow ones, leave room for their alignment
+    const size_t ibSize = narrowIBSize + sizeof(uint32_t) + wideIBSize;
+    const size_t instancesSize = instances.size() * sizeof(DrawInstance);
+
+    // the whole arena goes up in one go, so grow the streams if it doesn't fit
+    if (vbSize > mVertexStream.GetSegmentSize() || ibSize > mIndexStream.GetSegmentSize()) {
+        stateCache.BindVertexArray(0);
+        mVertexStream.Reserve(vbSize);
+        mIndexStream.Reserve(ibSize);
+        this->SetupVertexArray();
+    }
+    // instance attributes are pointed at the stream per draw, nothing to set up again
+    if (instancesSize > mInstanceStream.GetSegmentSize()) {
+        mInstanceStream.Reserve(instancesSize);
+    }
+
+    stateCache.BindVertexArray(cache ? mResidentVAO : mVAO);
+
+    this->UpdateViewParams();
+    stateCache.BindBufferBase(GL_UNIFORM_BUFFER, kViewParamsBinding, mViewParamsUBO);
+
+    // per-draw table is small, plain orphaning upload is good enough
+    const std::vector<DrawData>& drawData = drawList.GetDrawData();
+    stateCache.BindBuffer(GL_TEXTURE_BUFFER, mDrawDataBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(drawData.size() * sizeof(DrawData)), drawData.data(), GL_STREAM_DRAW);
+    stateCache.BindTextureBuffer(mDrawDataSlot, mDrawDataTexture);
+    mDrawStats.uploadedBytes += drawData.size() * sizeof(DrawData) + narrowIBSize + wideIBSize;
+
+    // resident records have no arena vertices, their indices are absolute
+    size_t vbOffset = 0;
+    if (vbSize) {
+        void* vbData = mVertexStream.Map(vbSize, sizeof(DrawVertex));
+        if (!vbData) {
+            return;
+        }
+        memcpy(vbData, vertices.data(), vbSize);
+        vbOffset = mVertexStream.Commit(vbSize);
+        mDrawStats.uploadedBytes += vbSize;
+    }
+
+    size_t narrowIBOffset = 0, wideIBOffset = 0;
+    if (narrowIBSize) {
+        void* ibData = mIndexStream.Map(narrowIBSize, sizeof(uint16_t));
+        if (!ibData) {
+            return;
+        }
+        memcpy(ibData, narrowIndices.data(), narrowIBSize);
+        narrowIBOffset = mIndexStream.Commit(narrowIBSize);
+    }
+    if (wideIBSize) {
+        void* ibData = mIndexStream.Map(wideIBSize, sizeof(uint32_t));
+        if (!ibData) {
+            return;
+        }
+        memcpy(ibData, wideIndices.data(), wideIBSize);
+        wideIBOffset = mIndexStream.Commit(wideIBSize);
+    }
+
+    size_t instancesOffset = 0;
+    if (instancesSize) {
+        void* instancesData = mInstanceStream.Map(instancesSize, sizeof(DrawInstance));
+        if (!instancesData) {
+            return;
+        }
+        memcpy(instancesData, instances.data(), instancesSize);
+        instancesOffset = mInstanceStream.Commit(instancesSize);
+        mDrawStats.uploadedBytes += instancesSize;
+    }
+
+    for (const DrawList::Record& record : records) {
+        if (record.numInstances) {
+            stateCache.BindVertexArray(mInstanceVAO);
+            this->BindInstances(instancesOffset + record.firstInstance * sizeof(DrawInstance));
+        } else {
+            stateCache.BindVertexArray(record.resident ? mResidentVAO : mVAO);
+        }
+
+        const GLint baseVertex = record.resident ? 0 : static_cast<GLint>(vbOffset / sizeof(DrawVertex) + record.firstVertex);
+        const size_t indicesOffset = record.wideIndices ? (wideIBOffset + record.firstIndex * sizeof(uint32_t))
+                                                        : (narrowIBOffset + record.firstIndex * sizeof(uint16_t));
+        this->SubmitRecord(record, textures, drawList.IsMultiTexture(), viewMode != DrawMode::Solid, baseVertex, indicesOffset);
+    }
+
+    mVertexStream.EndFrame();
+    mIndexStream.EndFrame();
+    mInstanceStream.EndFrame();
 }
 
 size_t Composition::GetNumSubCompositions() const {
@@ -552,300 +942,418 @@ void Composition::AddSubComposition(const aeMovieSubComposition* subComposition)
 }
 
 
-static GLuint CompileShader(const char* src, const GLenum type, std::string& log) {
-    GLuint shader = glCreateShader(type);
-    if (shader) {
-        GLint status = 0;
-        glShaderSource(shader, 1, &src, 0);
-        glCompileShader(shader);
-        glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
-
-        // we grab the log anyway
-        GLint infoLen = 0;
-        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLen);
-        if (infoLen > 1) {
-            log.resize(infoLen);
-            glGetShaderInfoLog(shader, infoLen, nullptr, const_cast<GLchar*>(log.data())); // non-const .data() in c++17
-        }
-
-        if (!status) {
-            glDeleteShader(shader);
-            shader = 0;
+// programs are shared through the cache, but uniform block bindings are program state
+// that a binary reload resets, so we apply ours every time
+static GLuint GetProgram(const char* vs, const char* fs) {
+    GLuint program = ShaderCache::Instance().GetProgram(vs, fs);
+    if (program) {
+        const GLuint blockIdx = glGetUniformBlockIndex(program, "ViewParams");
+        if (blockIdx != GL_INVALID_INDEX) {
+            glUniformBlockBinding(program, blockIdx, kViewParamsBinding);
         }
     }
-    return shader;
+    return program;
 }
 
-static GLuint CreateShader(const char* vs, const char* fs) {
-    std::string vsLog, fsLog;
-    GLuint vertexShader = CompileShader(vs, GL_VERTEX_SHADER, vsLog);
-    GLuint fragmentShader = CompileShader(fs, GL_FRAGMENT_SHADER, fsLog);
-
-    GLuint shader = 0;
-
-    if (vertexShader && fragmentShader) {
-        shader = glCreateProgram();
-        if (shader) {
-            glAttachShader(shader, vertexShader);
-            glAttachShader(shader, fragmentShader);
-            glLinkProgram(shader);
-
-            // we don't need our shader objects anymore
-            glDeleteShader(vertexShader);
-            glDeleteShader(fragmentShader);
-
-            // grab the log
-            GLint infoLen = 0;
-            glGetProgramiv(shader, GL_INFO_LOG_LENGTH, &infoLen);
-            if (infoLen > 1) {
-                std::string log; log.resize(infoLen);
-                glGetProgramInfoLog(shader, infoLen, nullptr, const_cast<GLchar*>(log.data())); // non-const .data() in c++17
+// program has to be in use, samplers the permutation doesn't have are just not found
+static void SetSamplerUniform(const GLuint program, const char* name, const GLint unit) {
+    const GLint location = glGetUniformLocation(program, name);
+    if (location >= 0) {
+        glUniform1i(location, unit);
+    }
+}
 
-                MyLog << "Shader link:" << MyEndl << log << MyEndl;
+void Composition::CreateDrawingData() {
+    const size_t vbSegmentSize = kStreamSegmentVertices * sizeof(DrawVertex);
+    const size_t ibSegmentSize = kStreamSegmentIndices * sizeof(uint16_t);
+
+    GLStateCache& stateCache = GLStateCache::Instance();
+
+    // how many textures we can bind at once for the multi-texture batching
+    GLint maxTextureUnits = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &maxTextureUnits);
+    mMaxBatchTextures = std::min(static_cast<size_t>(std::max(maxTextureUnits, 2)), kMaxBatchTextures);
+    // vertex shader reads the draw table from the unit after them, still well within the combined limit
+    mDrawDataSlot = mMaxBatchTextures;
+
+    // create shader programs, one per shading, alpha & wire mode, so there is no branching in the shaders
+    for (size_t shading = 0; shading < DrawList::kNumShadings; ++shading) {
+        for (size_t alpha = 0; alpha < DrawList::kNumAlphaModes; ++alpha) {
+            const DrawList::Shading s = static_cast<DrawList::Shading>(shading);
+            const DrawList::AlphaMode a = static_cast<DrawList::AlphaMode>(alpha);
+            const std::string vs = MakeVertexShader(s, a, false, false);
+            const std::string fs = MakeFragmentShader(s, a, false);
+            const std::string multiFS = MakeMultiFragmentShader(mMaxBatchTextures, s, a, false);
+            mPrograms[shading][alpha] = GetProgram(vs.c_str(), fs.c_str());
+            // solid meshes are drawn with the white texture in multi-texture mode
+            if (s != DrawList::Shading::Solid) {
+                mMultiPrograms[shading][alpha] = GetProgram(vs.c_str(), multiFS.c_str());
             }
-
-            GLint status = 0;
-            glGetProgramiv(shader, GL_LINK_STATUS, &status);
-            if (!status) {
-                glDeleteProgram(shader);
-            } else {
-                glUseProgram(shader);
+            // wireframe lists are never instanced
+            const std::string wireVS = MakeVertexShader(s, a, false, true);
+            const std::string wireFS = MakeFragmentShader(s, a, true);
+            mWirePrograms[shading][alpha] = GetProgram(wireVS.c_str(), wireFS.c_str());
+            if (s != DrawList::Shading::Solid) {
+                const std::string wireMultiFS = MakeMultiFragmentShader(mMaxBatchTextures, s, a, true);
+                mWireMultiPrograms[shading][alpha] = GetProgram(wireVS.c_str(), wireMultiFS.c_str());
+            }
+            // matte meshes are never instanced
+            if (s != DrawList::Shading::TextureMatte) {
+                const std::string instancedVS = MakeVertexShader(s, a, true, false);
+                mInstancedPrograms[shading][alpha] = GetProgram(instancedVS.c_str(), fs.c_str());
+                if (s != DrawList::Shading::Solid) {
+                    mInstancedMultiPrograms[shading][alpha] = GetProgram(instancedVS.c_str(), multiFS.c_str());
+                }
             }
-        }
-    } else {
-        if (!vsLog.empty()) {
-            MyLog <<"Vertex shader compilation:" << MyEndl << vsLog << MyEndl;
-        }
-        if (!fsLog.empty()) {
-            MyLog << "Fragment shader compilation:" << MyEndl << fsLog << MyEndl;
         }
     }
+    mMultiTextureBatching = mMultiTextureBatching && this->HasMultiPrograms();
+    mInstancing = mInstancing && this->HasInstancedPrograms();
+    mUnifiedBlending = mUnifiedBlending && this->HasUnifiedPrograms();
+
+    // uniform buffer for ortho matrix, scale & offset, filled on first Submit
+    glGenBuffers(1, &mViewParamsUBO);
+    stateCache.BindBuffer(GL_UNIFORM_BUFFER, mViewParamsUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(ViewParams), nullptr, GL_DYNAMIC_DRAW);
+    mViewParamsDirty = true;
+
+    // per-draw table, refilled every Submit
+    glGenBuffers(1, &mDrawDataBuffer);
+    stateCache.BindBuffer(GL_TEXTURE_BUFFER, mDrawDataBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(DrawData), nullptr, GL_STREAM_DRAW);
+    glGenTextures(1, &mDrawDataTexture);
+    stateCache.BindTextureBuffer(mDrawDataSlot, mDrawDataTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, mDrawDataBuffer);
+
+    // samplers of the permutations that don't use them are just not found
+    std::vector<GLint> units(mMaxBatchTextures);
+    for (size_t i = 0; i < mMaxBatchTextures; ++i) {
+        units[i] = static_cast<GLint>(i);
+    }
 
-    return shader;
-}
-
-void Composition::CreateDrawingData() {
-    const GLsizeiptr vbSize = static_cast<GLsizeiptr>(kMaxVerticesToDraw * sizeof(DrawVertex));
-    const GLsizeiptr ibSize = static_cast<GLsizeiptr>(kMaxIndicesToDraw * sizeof(uint16_t));
-
-    // create shader program
-    mShader = CreateShader(sVertexShader, sFragmentShader);
-    mWireShader = CreateShader(sWireVertexShader, sWireFragmentShader);
-
-    const aeMovieCompositionData* data = ae_get_movie_composition_composition_data(mComposition);
+    for (size_t shading = 0; shading < DrawList::kNumShadings; ++shading) {
+        for (size_t alpha = 0; alpha < DrawList::kNumAlphaModes; ++alpha) {
+            for (const GLuint program : { mPrograms[shading][alpha], mWirePrograms[shading][alpha] }) {
+                if (program) {
+                    stateCache.UseProgram(program);
+                    SetSamplerUniform(program, "uTextureRGB", kTextureRGBSlot);
+                    SetSamplerUniform(program, "uTextureA", kTextureASlot);
+                    SetSamplerUniform(program, "uDrawData", static_cast<GLint>(mDrawDataSlot));
+                }
+            }
 
-    // Set initial ortho matrix, scale & offset
-    this->SetViewportSize(mViewportWidth, mViewportHeight);
-    this->SetContentScale(mContentScale);
-    this->SetContentOffset(mContentOffX, mContentOffY);
+            const GLuint instancedProgram = mInstancedPrograms[shading][alpha];
+            if (instancedProgram) {
+                stateCache.UseProgram(instancedProgram);
+                SetSamplerUniform(instancedProgram, "uTextureRGB", kTextureRGBSlot);
+            }
 
-    glUseProgram(mShader);
-    mIsPremultAlphaUniform = glGetUniformLocation(mShader, "uIsPremultAlpha");
-    if (mIsPremultAlphaUniform >= 0) {
-        glUniform1i(mIsPremultAlphaUniform, GL_FALSE);
-    }
+            for (const GLuint multiProgram : { mMultiPrograms[shading][alpha], mInstancedMultiPrograms[shading][alpha], mWireMultiPrograms[shading][alpha] }) {
+                if (multiProgram) {
+                    stateCache.UseProgram(multiProgram);
+                    SetSamplerUniform(multiProgram, "uDrawData", static_cast<GLint>(mDrawDataSlot));
 
-    GLint texLocRGB = glGetUniformLocation(mShader, "uTextureRGB");
-    if (texLocRGB >= 0) {
-        glUniform1i(texLocRGB, kTextureRGBSlot);
+                    GLint texLocs = glGetUniformLocation(multiProgram, "uTextures");
+                    if (texLocs >= 0) {
+                        glUniform1iv(texLocs, static_cast<GLsizei>(mMaxBatchTextures), units.data());
+                    }
+                }
+            }
+        }
     }
 
-    GLint texLocA = glGetUniformLocation(mShader, "uTextureA");
-    if (texLocA >= 0) {
-        glUniform1i(texLocA, kTextureASlot);
-    }
+    // create streaming vertex & index buffers
+    // no vao must be bound here, or creating the index stream would change its element buffer
+    stateCache.BindVertexArray(0);
+    mVertexStream.Create(GL_ARRAY_BUFFER, vbSegmentSize);
+    mIndexStream.Create(GL_ELEMENT_ARRAY_BUFFER, ibSegmentSize);
+    mInstanceStream.Create(GL_ARRAY_BUFFER, kStreamSegmentInstances * sizeof(DrawInstance));
 
-    // create vertex buffer
-    glGenBuffers(1, &mVB);
-    glBindBuffer(GL_ARRAY_BUFFER, mVB);
-    glBufferData(GL_ARRAY_BUFFER, vbSize, nullptr, GL_DYNAMIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // create vaos to hold vertex attribs bindings, the resident ones are set up with their buffer
+    glGenVertexArrays(1, &mVAO);
+    glGenVertexArrays(1, &mResidentVAO);
+    glGenVertexArrays(1, &mInstanceVAO);
+    this->SetupVertexArray();
+}
 
-    // create index buffer
-    glGenBuffers(1, &mIB);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIB);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, ibSize, nullptr, GL_DYNAMIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+static void SetupVertexAttribs(const GLuint vao, const GLuint vertexBuffer, const GLuint indexBuffer) {
+    GLStateCache& stateCache = GLStateCache::Instance();
 
-    // create vao to hold vertex attribs bindings
-    glGenVertexArrays(1, &mVAO);
-    glBindVertexArray(mVAO);
+    stateCache.BindVertexArray(vao);
 
     // attach vb
-    glBindBuffer(GL_ARRAY_BUFFER, mVB);
+    stateCache.BindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
 
     // enable our attributes
     glEnableVertexAttribArray(kVertexPosAttribIdx);
-    glEnableVertexAttribArray(kVertexUV0AttribIdx);
-    glEnableVertexAttribArray(kVertexUV1AttribIdx);
-    glEnableVertexAttribArray(kVertexColorAttribIdx);
+    glEnableVertexAttribArray(kVertexUVAttribIdx);
+    glEnableVertexAttribArray(kVertexDrawIdAttribIdx);
 
     // bind our attributes
     const GLsizei stride = static_cast<GLsizei>(sizeof(DrawVertex));
-    glVertexAttribPointer(kVertexPosAttribIdx,   3, GL_FLOAT,         GL_FALSE, stride, _GL_OFFSET(DrawVertex, pos));
-    glVertexAttribPointer(kVertexUV0AttribIdx,   2, GL_FLOAT,         GL_FALSE, stride, _GL_OFFSET(DrawVertex, uv0));
-    glVertexAttribPointer(kVertexUV1AttribIdx,   2, GL_FLOAT,         GL_FALSE, stride, _GL_OFFSET(DrawVertex, uv1));
-    glVertexAttribPointer(kVertexColorAttribIdx, 4, GL_UNSIGNED_BYTE, GL_TRUE,  stride, _GL_OFFSET(DrawVertex, color));
+    glVertexAttribPointer(kVertexPosAttribIdx,     2, GL_FLOAT,          GL_FALSE, stride, _GL_OFFSET(DrawVertex, pos));
+    glVertexAttribPointer(kVertexUVAttribIdx,      2, GL_UNSIGNED_SHORT, GL_TRUE,  stride, _GL_OFFSET(DrawVertex, uv));
+    glVertexAttribIPointer(kVertexDrawIdAttribIdx, 1, GL_UNSIGNED_INT,             stride, _GL_OFFSET(DrawVertex, drawId));
 
     // attach ib
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIB);
+    stateCache.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
 }
 
-void Composition::DestroyDrawingData() {
-    glBindVertexArray(mVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, mVB);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIB);
-    glUnmapBuffer(GL_ARRAY_BUFFER);
-    glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+// only the local uv comes from the resident mesh, the instance attributes are pointed at
+// the draw's instances by BindInstances, as there's no base instance in GL 3.3
+static void SetupInstanceAttribs(const GLuint vao, const GLuint vertexBuffer, const GLuint indexBuffer) {
+    GLStateCache& stateCache = GLStateCache::Instance();
+
+    stateCache.BindVertexArray(vao);
 
-    glDeleteBuffers(1, &mVB);
-    glDeleteBuffers(1, &mIB);
-    glDeleteVertexArrays(1, &mVAO);
+    stateCache.BindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glEnableVertexAttribArray(kVertexUVAttribIdx);
+    glVertexAttribPointer(kVertexUVAttribIdx, 2, GL_UNSIGNED_SHORT, GL_TRUE, static_cast<GLsizei>(sizeof(DrawVertex)), _GL_OFFSET(DrawVertex, uv));
+
+    const GLuint instanceAttribs[] = { kInstanceAffineXAttribIdx, kInstanceAffineYAttribIdx, kInstanceUVRectAttribIdx, kInstanceColorAttribIdx, kInstanceSlotAttribIdx };
+    for (const GLuint attrib : instanceAttribs) {
+        glEnableVertexAttribArray(attrib);
+        glVertexAttribDivisor(attrib, 1);
+    }
 
-    glDeleteShader(mShader);
-    glDeleteShader(mWireShader);
+    stateCache.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
 }
 
-void Composition::BeginDraw() {
-    glBindVertexArray(mVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, mVB);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIB);
-    mVerticesData = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
-    mIndicesData = glMapBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_WRITE_ONLY);
+void Composition::SetupVertexArray() {
+    SetupVertexAttribs(mVAO, mVertexStream.GetBuffer(), mIndexStream.GetBuffer());
+    // resident geometry shares the index stream
+    if (mResidentBuffer) {
+        SetupVertexAttribs(mResidentVAO, mResidentBuffer, mIndexStream.GetBuffer());
+        SetupInstanceAttribs(mInstanceVAO, mResidentBuffer, mIndexStream.GetBuffer());
+    }
 }
 
-void Composition::EndDraw() {
-    this->FlushDraw();
+void Composition::BindInstances(const size_t offset) {
+    GLStateCache::Instance().BindBuffer(GL_ARRAY_BUFFER, mInstanceStream.GetBuffer());
 
-    glUnmapBuffer(GL_ARRAY_BUFFER);
-    glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+    const GLsizei stride = static_cast<GLsizei>(sizeof(DrawInstance));
+    const uint8_t* base = reinterpret_cast<const uint8_t*>(offset);
+    glVertexAttribPointer(kInstanceAffineXAttribIdx, 3, GL_FLOAT, GL_FALSE, stride, base + offsetof(DrawInstance, affineX));
+    glVertexAttribPointer(kInstanceAffineYAttribIdx, 3, GL_FLOAT, GL_FALSE, stride, base + offsetof(DrawInstance, affineY));
+    glVertexAttribPointer(kInstanceUVRectAttribIdx,  4, GL_FLOAT, GL_FALSE, stride, base + offsetof(DrawInstance, uvRect));
+    glVertexAttribPointer(kInstanceColorAttribIdx,   4, GL_FLOAT, GL_FALSE, stride, base + offsetof(DrawInstance, color));
+    glVertexAttribIPointer(kInstanceSlotAttribIdx,   1, GL_UNSIGNED_INT,    stride, base + offsetof(DrawInstance, slot));
 }
 
-void Composition::DrawMesh(const aeMovieRenderMesh* mesh, const ResourceImage* imageRGB, const ResourceImage* imageA, const float* alternativeUV) {
-    const size_t verticesLeft = kMaxVerticesToDraw - mNumVertices;
-    const size_t indicesLeft = kMaxIndicesToDraw - mNumIndices;
+size_t Composition::UploadResidentGeometry(const GeometryCache& cache) {
+    GLStateCache& stateCache = GLStateCache::Instance();
+
+    const size_t numVertices = cache.GetNumVertices();
+    if (numVertices > mResidentCapacity) {
+        // ranges never move, so the new buffer starts as a copy of the old one
+        const size_t newCapacity = std::max(std::max(numVertices, mResidentCapacity * 2), kStreamSegmentVertices);
+
+        GLuint newBuffer = 0;
+        glGenBuffers(1, &newBuffer);
+        stateCache.BindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(newCapacity * sizeof(DrawVertex)), nullptr, GL_DYNAMIC_DRAW);
+        if (mResidentBuffer) {
+            stateCache.BindBuffer(GL_COPY_READ_BUFFER, mResidentBuffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, static_cast<GLsizeiptr>(mResidentCapacity * sizeof(DrawVertex)));
+            stateCache.DeleteBuffer(mResidentBuffer);
+        }
 
-    GLuint newTextureRGB = ResourcesManager::Instance().GetWhiteTexture();
-    if (imageRGB != nullptr && imageRGB->textureRes != nullptr) {
-        newTextureRGB = imageRGB->textureRes->texture;
+        mResidentBuffer = newBuffer;
+        mResidentCapacity = newCapacity;
+        this->SetupVertexArray();
     }
 
-    GLuint newTextureA = ResourcesManager::Instance().GetWhiteTexture();
-    if (imageA != nullptr && imageA->textureRes != nullptr) {
-        newTextureA = imageA->textureRes->texture;
+    const std::vector<DrawVertex>& staging = cache.GetStaging();
+    size_t uploadedBytes = 0;
+
+    stateCache.BindBuffer(GL_ARRAY_BUFFER, mResidentBuffer);
+    for (const GeometryCache::Upload& upload : cache.GetUploads()) {
+        const size_t size = upload.numVertices * sizeof(DrawVertex);
+        glBufferSubData(GL_ARRAY_BUFFER, static_cast<GLintptr>(upload.firstVertex * sizeof(DrawVertex)), static_cast<GLsizeiptr>(size), staging.data() + upload.stagingVertex);
+        uploadedBytes += size;
     }
 
-    const bool isPremultAlpha = (imageRGB && imageRGB->premultAlpha);
-    const BlendMode newBlendMode = (mesh->blend_mode == AE_MOVIE_BLEND_ADD) ? BlendMode::Add : BlendMode::Normal;
-
-    if (mesh->vertexCount > verticesLeft      ||
-        mesh->indexCount > indicesLeft        ||
-        newTextureRGB != mCurrentTextureRGB   ||
-        newTextureA != mCurrentTextureA       ||
-        isPremultAlpha != mPremultipliedAlpha ||
-        newBlendMode != mCurrentBlendMode) {
-        this->FlushDraw();
-    }
-
-    mCurrentTextureRGB = newTextureRGB;
-    mCurrentTextureA = newTextureA;
-    mCurrentBlendMode = newBlendMode;
-    mPremultipliedAlpha = isPremultAlpha;
-
-    DrawVertex* vertices = reinterpret_cast<DrawVertex*>(mVerticesData) + mNumVertices;
-    uint16_t* indices = reinterpret_cast<uint16_t*>(mIndicesData) + mNumIndices;
-
-    for (size_t i = 0; i < mesh->vertexCount; ++i, ++vertices) {
-        vertices->pos[0] = mesh->position[i][0];
-        vertices->pos[1] = mesh->position[i][1];
-        vertices->pos[2] = mesh->position[i][2];
-
-        if (alternativeUV) {
-            vertices->uv0[0] = alternativeUV[i * 2 + 0];
-            vertices->uv0[1] = alternativeUV[i * 2 + 1];
-            vertices->uv1[0] = mesh->uv[i][0];
-            vertices->uv1[1] = mesh->uv[i][1];
-        } else {
-            vertices->uv1[0] = vertices->uv0[0] = mesh->uv[i][0];
-            vertices->uv1[1] = vertices->uv0[1] = mesh->uv[i][1];
-        }
+    return uploadedBytes;
+}
+
+void Composition::DestroyDrawingData() {
+    GLStateCache& stateCache = GLStateCache::Instance();
+
+    stateCache.BindVertexArray(mVAO);
+    mVertexStream.Destroy();
+    mIndexStream.Destroy();
+    mInstanceStream.Destroy();
+    stateCache.BindVertexArray(0);
+
+    stateCache.DeleteVertexArray(mVAO);
+    stateCache.DeleteVertexArray(mResidentVAO);
+    stateCache.DeleteVertexArray(mInstanceVAO);
+    stateCache.DeleteBuffer(mResidentBuffer);
+    mResidentBuffer = 0;
+    mResidentCapacity = 0;
+    mGeometryCache.Clear();
+    stateCache.DeleteBuffer(mViewParamsUBO);
+    stateCache.DeleteTexture(mDrawDataTexture);
+    stateCache.DeleteBuffer(mDrawDataBuffer);
+
+    // programs are owned by the ShaderCache
+    memset(mPrograms, 0, sizeof(mPrograms));
+    memset(mMultiPrograms, 0, sizeof(mMultiPrograms));
+    memset(mInstancedPrograms, 0, sizeof(mInstancedPrograms));
+    memset(mInstancedMultiPrograms, 0, sizeof(mInstancedMultiPrograms));
+    memset(mWirePrograms, 0, sizeof(mWirePrograms));
+    memset(mWireMultiPrograms, 0, sizeof(mWireMultiPrograms));
+
+}
 
-        vertices->color = FloatColorToUint(mesh->color, mesh->opacity);
+void Composition::UpdateViewParams() {
+    if (!mViewParamsDirty) {
+        return;
     }
 
-    for (size_t i = 0; i < mesh->indexCount; ++i) {
-        indices[i] = static_cast<uint16_t>((mesh->indices[i] + mNumVertices) & 0xffff);
+    const float left = 0.0f;
+    const float right = mViewportWidth;
+    const float bottom = mViewportHeight;
+    const float top = 0.0f;
+    const float zNear = -1.0f;
+    const float zFar = 1.0f;
+
+    ViewParams params;
+    MakeOrtho2DMat(left, right, top, bottom, zNear, zFar, params.wvp);
+    params.offset[0] = mContentOffX;
+    params.offset[1] = mContentOffY;
+    params.scale = mContentScale;
+    switch (mViewParamsMode) {
+        case DrawMode::Solid:                   params.wireMode = 0.0f; break;
+        case DrawMode::SolidWithWireOverlay:    params.wireMode = 1.0f; break;
+        case DrawMode::Wireframe:               params.wireMode = 2.0f; break;
     }
 
-    mNumVertices += mesh->vertexCount;
-    mNumIndices += mesh->indexCount;
+    GLStateCache::Instance().BindBuffer(GL_UNIFORM_BUFFER, mViewParamsUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ViewParams), &params);
 
-    this->FlushDraw();
+    mViewParamsDirty = false;
 }
 
-void Composition::FlushDraw() {
-    if (mNumIndices) {
-        const bool drawSolid = (mDrawMode == DrawMode::Solid || mDrawMode == DrawMode::SolidWithWireOverlay);
-        const bool drawWire = (mDrawMode == DrawMode::Wireframe || mDrawMode == DrawMode::SolidWithWireOverlay);
+void Composition::AddMesh(DrawList& drawList, const aeMovieRenderMesh* mesh, const void* key, const ResourceImage* imageRGB, const ResourceImage* imageA, const float* uvAffine) {
+    const bool hasTextureRGB = (imageRGB != nullptr && imageRGB->textureRes != nullptr);
+    const bool hasTextureA = (imageA != nullptr && imageA->textureRes != nullptr);
 
-        GLint isPremultAlpha = GL_FALSE;
+    // white texture stands in for a missing rgb one, the multi-texture path still needs something to sample
+    const GLuint textureRGB = hasTextureRGB ? imageRGB->textureRes->texture : ResourcesManager::Instance().GetWhiteTexture();
+    const GLuint textureA = hasTextureA ? imageA->textureRes->texture : ResourcesManager::Instance().GetWhiteTexture();
 
-        glEnable(GL_BLEND);
+    DrawList::Shading shading = DrawList::Shading::Solid;
+    if (uvAffine) {
+        // only the matte shading knows how to make the rgb uvs, a missing matte samples as white
+        shading = DrawList::Shading::TextureMatte;
+    } else if (hasTextureRGB) {
+        shading = DrawList::Shading::Texture;
+    }
 
-        switch (mCurrentBlendMode) {
-            case BlendMode::Normal: {
-                if (mPremultipliedAlpha) {
-                    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-                } else {
-                    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-                }
-            } break;
+    const bool isPremultAlpha = (imageRGB && imageRGB->premultAlpha);
 
-            case BlendMode::Add: {
-                if (mPremultipliedAlpha) {
-                    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-                } else {
-                    glBlendFunc(GL_ONE, GL_ONE);
-                }
-            } break;
-        }
+    drawList.AddMesh(mesh, key, shading, textureRGB, textureA, isPremultAlpha, uvAffine);
+}
 
-        glUnmapBuffer(GL_ARRAY_BUFFER);
-        glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+bool Composition::HasMultiPrograms() const {
+    for (size_t alpha = 0; alpha < DrawList::kNumAlphaModes; ++alpha) {
+        if (!mMultiPrograms[static_cast<size_t>(DrawList::Shading::Texture)][alpha] ||
+            !mMultiPrograms[static_cast<size_t>(DrawList::Shading::TextureMatte)][alpha] ||
+            !mWireMultiPrograms[static_cast<size_t>(DrawList::Shading::Texture)][alpha] ||
+            !mWireMultiPrograms[static_cast<size_t>(DrawList::Shading::TextureMatte)][alpha]) {
+            return false;
+        }
+    }
+    return true;
+}
 
-        glActiveTexture(GL_TEXTURE0 + kTextureRGBSlot);
-        glBindTexture(GL_TEXTURE_2D, mCurrentTextureRGB);
-        glActiveTexture(GL_TEXTURE0 + kTextureASlot);
-        glBindTexture(GL_TEXTURE_2D, mCurrentTextureA);
+bool Composition::HasInstancedPrograms() const {
+    for (size_t alpha = 0; alpha < DrawList::kNumAlphaModes; ++alpha) {
+        if (!mInstancedPrograms[static_cast<size_t>(DrawList::Shading::Solid)][alpha] ||
+            !mInstancedPrograms[static_cast<size_t>(DrawList::Shading::Texture)][alpha] ||
+            !mInstancedMultiPrograms[static_cast<size_t>(DrawList::Shading::Texture)][alpha]) {
+            return false;
+        }
+    }
+    return true;
+}
 
-        if (drawSolid) {
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-            glUseProgram(mShader);
-            glUniform1i(mIsPremultAlphaUniform, mPremultipliedAlpha ? GL_TRUE : GL_FALSE);
-            glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(mNumIndices), GL_UNSIGNED_SHORT, nullptr);
+bool Composition::HasUnifiedPrograms() const {
+    const size_t unified = static_cast<size_t>(DrawList::AlphaMode::Unified);
+    for (size_t shading = 0; shading < DrawList::kNumShadings; ++shading) {
+        if (!mPrograms[shading][unified] || !mWirePrograms[shading][unified]) {
+            return false;
         }
+    }
+    return true;
+}
 
-        if (drawWire) {
-            glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-            glUseProgram(mWireShader);
-            glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(mNumIndices), GL_UNSIGNED_SHORT, nullptr);
+void Composition::SubmitRecord(const DrawList::Record& record, const std::vector<GLuint>& textures, const bool multiTexture, const bool wireframe, const GLint baseVertex, const size_t indicesOffset) {
+    const GLsizei numIndices = static_cast<GLsizei>(record.numIndices);
+    const GLenum indexType = record.wideIndices ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+    const GLvoid* indicesPtr = reinterpret_cast<const GLvoid*>(indicesOffset);
+    const DrawList::AlphaMode alphaMode = record.state.alphaMode;
+    // unified records always come out premultiplied, additive ones with alpha 0, and they are all Normal
+    const bool premultAlpha = (alphaMode != DrawList::AlphaMode::Straight);
 
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-        }
+    GLStateCache& stateCache = GLStateCache::Instance();
+
+    stateCache.SetEnabled(GL_BLEND, true);
+
+    switch (record.state.blendMode) {
+        case DrawList::BlendMode::Normal: {
+            if (premultAlpha) {
+                stateCache.BlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+            } else {
+                stateCache.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            }
+        } break;
+
+        case DrawList::BlendMode::Add: {
+            if (premultAlpha) {
+                stateCache.BlendFunc(GL_SRC_ALPHA, GL_ONE);
+            } else {
+                stateCache.BlendFunc(GL_ONE, GL_ONE);
+            }
+        } break;
+    }
 
-        mVerticesData = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
-        mIndicesData = glMapBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_WRITE_ONLY);
+    if (multiTexture) {
+        for (size_t i = 0; i < record.numTextures; ++i) {
+            stateCache.BindTexture(i, textures[record.firstTexture + i]);
+        }
+    } else {
+        // only what the permutation samples, solid records leave the units alone
+        if (record.state.shading != DrawList::Shading::Solid) {
+            stateCache.BindTexture(kTextureRGBSlot, record.state.textureRGB);
+        }
+        if (record.state.shading == DrawList::Shading::TextureMatte) {
+            stateCache.BindTexture(kTextureASlot, record.state.textureA);
+        }
     }
 
-    mNumVertices = 0;
-    mNumIndices = 0;
+    // instanced records have absolute indices into the resident buffer
+    const bool instanced = (record.numInstances > 0);
+    const GLsizei numInstances = static_cast<GLsizei>(record.numInstances);
+
+    const size_t shading = static_cast<size_t>(record.state.shading);
+    const size_t alpha = static_cast<size_t>(alphaMode);
+    if (instanced) {
+        stateCache.UseProgram(multiTexture ? mInstancedMultiPrograms[shading][alpha] : mInstancedPrograms[shading][alpha]);
+        glDrawElementsInstanced(GL_TRIANGLES, numIndices, indexType, indicesPtr, numInstances);
+    } else if (wireframe) {
+        stateCache.UseProgram(multiTexture ? mWireMultiPrograms[shading][alpha] : mWirePrograms[shading][alpha]);
+        glDrawElementsBaseVertex(GL_TRIANGLES, numIndices, indexType, indicesPtr, baseVertex);
+    } else {
+        stateCache.UseProgram(multiTexture ? mMultiPrograms[shading][alpha] : mPrograms[shading][alpha]);
+        glDrawElementsBaseVertex(GL_TRIANGLES, numIndices, indexType, indicesPtr, baseVertex);
+    }
+    ++mDrawStats.numDrawCalls;
 }
 
-
 // callbacks
 bool Composition::OnProvideNode(const aeMovieNodeProviderCallbackData* _callbackData, void** _nd) {
-    AE_UNUSED(_nd);
-
     MyLog << "Node provider callback" << MyEndl;
 
     if (ae_is_movie_layer_data_track_mate(_callbackData->layer) == AE_TRUE) {
@@ -853,6 +1361,10 @@ bool Composition::OnProvideNode(const aeMovieNodeProviderCallbackData* _callback
         return true;
     }
 
+    LayerNode* node = new LayerNode();
+    node->trackMatteImage = nullptr;
+    *_nd = node;
+
     aeMovieLayerTypeEnum layerType = ae_get_movie_layer_data_type(_callbackData->layer);
 
     MyLog << " Layer: '" << ae_get_movie_layer_data_name(_callbackData->layer) << MyEndl;
@@ -879,8 +1391,7 @@ bool Composition::OnProvideNode(const aeMovieNodeProviderCallbackData* _callback
             case AE_MOVIE_LAYER_TYPE_IMAGE: {
                 MyLog << " image" << MyEndl;
 
-                ResourceImage* resourceTrackMatteImage = reinterpret_cast<ResourceImage*>(ae_get_movie_layer_data_resource_data(_callbackData->track_matte_layer));
-                *_nd = reinterpret_cast<ae_voidptr_t>(resourceTrackMatteImage);
+                node->trackMatteImage = reinterpret_cast<ResourceImage*>(ae_get_movie_layer_data_resource_data(_callbackData->track_matte_layer));
             } break;
             default:
                 MyLog << " other" << MyEndl;
@@ -895,6 +1406,12 @@ void Composition::OnDeleteNode(const aeMovieNodeDeleterCallbackData* _callbackDa
     MyLog << "Node destroyer callback." << MyEndl;
     aeMovieLayerTypeEnum layerType = ae_get_movie_layer_data_type(_callbackData->layer);
     MyLog << " Layer type: " << layerType << MyEndl;
+
+    LayerNode* node = reinterpret_cast<LayerNode*>(_callbackData->element);
+    if (node) {
+        mGeometryCache.Remove(node);
+        delete node;
+    }
 }
 
 void Composition::OnUpdateNode(const aeMovieNodeUpdateCallbackData* _callbackData) {
@@ -1,5 +1,8 @@
 #pragma once
 #include "utils.h"
+#include "streambuffer.h"
+#include "drawlist.h"
+#include "geometrycache.h"
 #include <glad/glad.h>
 
 struct aeMovieData;
@@ -30,9 +33,16 @@ public:
         SolidWithWireOverlay
     };
 
-    enum class BlendMode : size_t {
-        Normal,
-        Add
+    // per-frame rendering counters, reset at the beginning of each Draw
+    struct DrawStats {
+        size_t  numMeshes;
+        size_t  numReorderedMeshes;
+        size_t  numInstancedMeshes;
+        size_t  numCulledMeshes;        // entirely off the viewport
+        size_t  numInvisibleMeshes;     // zero opacity
+        size_t  numDrawCalls;
+        size_t  uploadedBytes;      // vertices, indices, instances & draw table
+        size_t  reusedBytes;        // resident vertices of unchanged layers
     };
 
 protected:
@@ -46,6 +56,37 @@ public:
     float       GetContentScale() const;
     void        SetContentOffset(const float offX, const float offY);
 
+    // when enabled, meshes with different textures share a batch with up to GetMaxBatchTextures() samplers bound
+    void        SetMultiTextureBatching(const bool enable);
+    bool        IsMultiTextureBatching() const;
+    size_t      GetMaxBatchTextures() const;
+
+    // when enabled, non-overlapping meshes may be drawn out of order to join an earlier batch
+    void        SetDrawReordering(const bool enable);
+    bool        IsDrawReordering() const;
+
+    // when enabled, dense frames convert their meshes on the ThreadPool
+    void        SetParallelPacking(const bool enable);
+    bool        IsParallelPacking() const;
+
+    // when enabled, layer vertices stay resident on the GPU and only changed layers are uploaded
+    void        SetGeometryCaching(const bool enable);
+    bool        IsGeometryCaching() const;
+
+    // when enabled (and geometry caching is), layers that only move as a whole are drawn as instances
+    // of a resident local mesh, all the quads of a batch with a single instanced draw
+    void        SetInstancing(const bool enable);
+    bool        IsInstancing() const;
+
+    // when enabled, meshes entirely outside the viewport are dropped before packing
+    void        SetViewportCulling(const bool enable);
+    bool        IsViewportCulling() const;
+
+    // when enabled, every mesh leaves the shader premultiplied and additive ones with alpha 0,
+    // so Normal & Add layers share one blend func and batch together
+    void        SetUnifiedBlending(const bool enable);
+    bool        IsUnifiedBlending() const;
+
     float       GetWidth() const;
     float       GetHeight() const;
 
@@ -65,6 +106,19 @@ public:
 
     void        Update(const float deltaTime);
     void        Draw(const DrawMode mode);
+    const DrawStats& GetDrawStats() const;
+
+    // Draw split in two stages:
+    // BuildCommandList only walks the composition meshes and fills the list, no GL calls are made,
+    // so it may run on a worker thread, just not concurrently with Update or Submit
+    // it reads the texture handles of the resources, which ResourcesManager::UpdatePendingTextures replaces
+    // (deleting the old ones), so it mustn't overlap that either and the list has to be submitted before the next one
+    // Submit uploads the list geometry and issues the draws, must be called on the GL thread
+    // with geometry caching only the list of the latest BuildCommandList can be submitted, older ones
+    // are skipped, a list that's never submitted loses nothing, its resident uploads go with the next one
+    // the wire modes need a list built for them, Submit draws other lists as Solid
+    void        BuildCommandList(DrawList& drawList, const DrawMode mode);
+    void        Submit(const DrawList& drawList, const DrawMode mode);
 
     // sub compositions
     size_t      GetNumSubCompositions() const;
@@ -80,12 +134,20 @@ protected:
     void        Create(const aeMovieData* moviewData, const aeMovieCompositionData* compData);
     void        AddSubComposition(const aeMovieSubComposition* subComposition);
     void        CreateDrawingData();
+    // (re)binds the vertex buffers to the vaos, needed again whenever one of them is recreated
+    void        SetupVertexArray();
+    // grows the resident buffer as needed and uploads what the cache packed this frame, returns the bytes uploaded
+    size_t      UploadResidentGeometry(const GeometryCache& cache);
+    // points the instance attributes of the bound instance vao at `offset` in the instance stream
+    void        BindInstances(const size_t offset);
     void        DestroyDrawingData();
 
-    void        BeginDraw();
-    void        EndDraw();
-    void        DrawMesh(const aeMovieRenderMesh* mesh, const ResourceImage* imageRGB, const ResourceImage* imageA, const float* alternativeUV);
-    void        FlushDraw();
+    void        UpdateViewParams();
+    void        AddMesh(DrawList& drawList, const aeMovieRenderMesh* mesh, const void* key, const ResourceImage* imageRGB, const ResourceImage* imageA, const float* uvAffine);
+    bool        HasMultiPrograms() const;
+    bool        HasInstancedPrograms() const;
+    bool        HasUnifiedPrograms() const;
+    void        SubmitRecord(const DrawList::Record& record, const std::vector<GLuint>& textures, const bool multiTexture, const bool wireframe, const GLint baseVertex, const size_t indicesOffset);
 
     bool        OnProvideNode(const aeMovieNodeProviderCallbackData* _callbackData, void** _nd);
     void        OnDeleteNode(const aeMovieNodeDeleterCallbackData* _callbackData);
@@ -102,22 +164,39 @@ private:
     std::vector<const aeMovieSubComposition*>   mSubCompositions;
 
     // rendering stuff
-    GLuint                                      mShader;
-    GLuint                                      mWireShader;
-    GLint                                       mIsPremultAlphaUniform;
+    // shader permutations, indexed by [DrawList::Shading][DrawList::AlphaMode]
+    GLuint                                      mPrograms[DrawList::kNumShadings][DrawList::kNumAlphaModes];
+    GLuint                                      mMultiPrograms[DrawList::kNumShadings][DrawList::kNumAlphaModes];    // no Solid ones
+    GLuint                                      mInstancedPrograms[DrawList::kNumShadings][DrawList::kNumAlphaModes];    // no TextureMatte ones
+    GLuint                                      mInstancedMultiPrograms[DrawList::kNumShadings][DrawList::kNumAlphaModes];   // Texture only
+    GLuint                                      mWirePrograms[DrawList::kNumShadings][DrawList::kNumAlphaModes];    // the edge drawing ones, for the wire modes
+    GLuint                                      mWireMultiPrograms[DrawList::kNumShadings][DrawList::kNumAlphaModes];    // no Solid ones
     GLuint                                      mVAO;
-    GLuint                                      mVB;
-    GLuint                                      mIB;
-    GLuint                                      mCurrentTextureRGB;
-    GLuint                                      mCurrentTextureA;
-    BlendMode                                   mCurrentBlendMode;
-    bool                                        mPremultipliedAlpha;
-    size_t                                      mNumVertices;
-    size_t                                      mNumIndices;
-    void*                                       mVerticesData;
-    void*                                       mIndicesData;
-
-    DrawMode                                    mDrawMode;
+    GLuint                                      mResidentVAO;       // same layout, over mResidentBuffer
+    GLuint                                      mResidentBuffer;
+    size_t                                      mResidentCapacity;  // in vertices
+    GLuint                                      mInstanceVAO;       // local uv from mResidentBuffer + instance attributes
+    GLuint                                      mDrawDataBuffer;
+    GLuint                                      mDrawDataTexture;   // buffer texture over mDrawDataBuffer
+    size_t                                      mDrawDataSlot;
+    GLuint                                      mViewParamsUBO;
+    bool                                        mViewParamsDirty;
+    DrawMode                                    mViewParamsMode;    // what the uploaded wire mode is for
+    StreamBuffer                                mVertexStream;
+    StreamBuffer                                mIndexStream;
+    StreamBuffer                                mInstanceStream;
+    bool                                        mMultiTextureBatching;
+    size_t                                      mMaxBatchTextures;
+    bool                                        mDrawReordering;
+    bool                                        mParallelPacking;
+    bool                                        mGeometryCaching;
+    bool                                        mInstancing;
+    bool                                        mViewportCulling;
+    bool                                        mUnifiedBlending;
+    GeometryCache                               mGeometryCache;
+    DrawList                                    mDrawList;
+
+    DrawStats                                   mDrawStats;
     float                                       mViewportWidth;
     float                                       mViewportHeight;
     float                                       mContentScale;
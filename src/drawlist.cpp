@@ -0,0 +1,885 @@
+#include "drawlist.h"
+#include "vertexpack.h"
+#include "threadpool.h"
+#include "geometrycache.h"
+#include "simplemath.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+extern "C" {
+#include <movie/movie.h>
+}
+
+
+// how many records back a mesh may travel when reordering
+static const size_t kMaxReorderDistance = 16;
+
+static const uint32_t kInvalidMesh = ~0u;
+static const uint32_t kInvalidVertex = ~0u;
+static const uint32_t kInvalidInstance = ~0u;
+
+// below this there's more to lose on waking the workers than to gain
+static const size_t kMinParallelPackVertices = 16 * 1024;
+
+// records up to this size are drawn with 16-bit indices
+static const uint32_t kMaxNarrowVertices = 64 * 1024;
+
+// how far a vertex may be off the fitted instance affine, in composition units
+static const float kInstanceTolerance = 1.0f / 256.0f;
+// local coordinates are 0..1, this is plenty for snapping and degenerate checks
+static const float kLocalEpsilon = 0.0001f;
+
+// every quad instance is drawn with this one, its uvs are the local coordinates
+static const ae_vector3_t kUnitQuadPositions[4] = { { 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f } };
+static const ae_vector2_t kUnitQuadUVs[4] = { { 0.0f, 0.0f }, { 1.0f, 0.0f }, { 1.0f, 1.0f }, { 0.0f, 1.0f } };
+static const ae_uint16_t kUnitQuadIndices[6] = { 0, 1, 2, 0, 2, 3 };
+
+// its address keys the unit quad in the geometry cache
+static const int kUnitQuadKey = 0;
+
+static const aeMovieRenderMesh& GetUnitQuadMesh() {
+    static aeMovieRenderMesh mesh;
+    static bool initialized = false;
+    if (!initialized) {
+        memset(&mesh, 0, sizeof(mesh));
+        mesh.vertexCount = 4;
+        mesh.indexCount = 6;
+        mesh.position = kUnitQuadPositions;
+        mesh.uv = kUnitQuadUVs;
+        mesh.indices = kUnitQuadIndices;
+        initialized = true;
+    }
+    return mesh;
+}
+
+static DrawList::Bounds CalcMeshBounds(const aeMovieRenderMesh* mesh, const uint32_t* vertexMap, const uint32_t numVertices) {
+    const size_t first = vertexMap ? vertexMap[0] : 0;
+    DrawList::Bounds bounds = { mesh->position[first][0], mesh->position[first][1], mesh->position[first][0], mesh->position[first][1] };
+    for (size_t v = 1; v < numVertices; ++v) {
+        const size_t i = vertexMap ? vertexMap[v] : v;
+        bounds.minX = std::min(bounds.minX, mesh->position[i][0]);
+        bounds.minY = std::min(bounds.minY, mesh->position[i][1]);
+        bounds.maxX = std::max(bounds.maxX, mesh->position[i][0]);
+        bounds.maxY = std::max(bounds.maxY, mesh->position[i][1]);
+    }
+    return bounds;
+}
+
+static void CopyIndices(std::vector<uint16_t>& narrow, std::vector<uint32_t>& wide, const bool toWide, const size_t dstIdx, const uint32_t* src, const size_t count) {
+    if (toWide) {
+        memcpy(wide.data() + dstIdx, src, count * sizeof(uint32_t));
+    } else {
+        uint16_t* dst = narrow.data() + dstIdx;
+        for (size_t i = 0; i < count; ++i) {
+            dst[i] = static_cast<uint16_t>(src[i]);
+        }
+    }
+}
+
+static void MergeBounds(DrawList::Bounds& dst, const DrawList::Bounds& src) {
+    dst.minX = std::min(dst.minX, src.minX);
+    dst.minY = std::min(dst.minY, src.minY);
+    dst.maxX = std::max(dst.maxX, src.maxX);
+    dst.maxY = std::max(dst.maxY, src.maxY);
+}
+
+// touching bounds count as overlapping, a shared edge can still rasterize into the same pixels
+static bool IsBoundsOverlap(const DrawList::Bounds& a, const DrawList::Bounds& b) {
+    return a.minX <= b.maxX && b.minX <= a.maxX &&
+           a.minY <= b.maxY && b.minY <= a.maxY;
+}
+
+static void CalcLocalPoint(const aeMovieRenderMesh* mesh, const size_t idx, const float uvRect[4], float local[2]) {
+    local[0] = (mesh->uv[idx][0] - uvRect[0]) / uvRect[2];
+    local[1] = (mesh->uv[idx][1] - uvRect[1]) / uvRect[3];
+}
+
+// finds the affine that maps the local uv (0..1 within uvRect) of the mesh to its positions,
+// fails unless every vertex agrees with it, so deformed or perspective meshes stay regular ones
+static bool FitLocalAffine(const aeMovieRenderMesh* mesh, const float uvRect[4], float affine[6]) {
+    // solid fills have no uv to go by
+    if (mesh->vertexCount < 3 || uvRect[2] <= 0.0f || uvRect[3] <= 0.0f) {
+        return false;
+    }
+
+    // widest basis: the first vertex, the farthest one from it and the farthest one off that line
+    float a[2], b[2], c[2], p[2];
+    CalcLocalPoint(mesh, 0, uvRect, a);
+
+    size_t bIdx = 0;
+    float maxDist = 0.0f;
+    for (size_t i = 1; i < mesh->vertexCount; ++i) {
+        CalcLocalPoint(mesh, i, uvRect, p);
+        const float dist = (p[0] - a[0]) * (p[0] - a[0]) + (p[1] - a[1]) * (p[1] - a[1]);
+        if (dist > maxDist) {
+            maxDist = dist;
+            bIdx = i;
+        }
+    }
+    CalcLocalPoint(mesh, bIdx, uvRect, b);
+
+    size_t cIdx = 0;
+    float maxArea = 0.0f;
+    for (size_t i = 1; i < mesh->vertexCount; ++i) {
+        CalcLocalPoint(mesh, i, uvRect, p);
+        const float area = std::abs((b[0] - a[0]) * (p[1] - a[1]) - (b[1] - a[1]) * (p[0] - a[0]));
+        if (area > maxArea) {
+            maxArea = area;
+            cIdx = i;
+        }
+    }
+    if (maxArea < kLocalEpsilon) {
+        return false;
+    }
+    CalcLocalPoint(mesh, cIdx, uvRect, c);
+
+    CalcUVAffine(affine, a, b, c, mesh->position[0], mesh->position[bIdx], mesh->position[cIdx]);
+
+    for (size_t i = 0; i < mesh->vertexCount; ++i) {
+        CalcLocalPoint(mesh, i, uvRect, p);
+        const float x = affine[0] + affine[1] * p[0] + affine[2] * p[1];
+        const float y = affine[3] + affine[4] * p[0] + affine[5] * p[1];
+        if (std::abs(x - mesh->position[i][0]) > kInstanceTolerance || std::abs(y - mesh->position[i][1]) > kInstanceTolerance) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// four vertices on the corners of the local square and two triangles splitting it along a diagonal,
+// so the unit quad covers exactly the same pixels, whatever the vertex order
+static bool IsUnitQuad(const aeMovieRenderMesh* mesh, const float uvRect[4]) {
+    if (mesh->vertexCount != 4 || mesh->indexCount != 6) {
+        return false;
+    }
+
+    // corner code: bit 0 is u, bit 1 is v
+    uint32_t corners[4];
+    uint32_t usedCorners = 0;
+    for (size_t i = 0; i < 4; ++i) {
+        float p[2];
+        CalcLocalPoint(mesh, i, uvRect, p);
+        uint32_t corner = 0;
+        for (size_t k = 0; k < 2; ++k) {
+            if (std::abs(p[k] - 1.0f) < kLocalEpsilon) {
+                corner |= 1u << k;
+            } else if (std::abs(p[k]) >= kLocalEpsilon) {
+                return false;
+            }
+        }
+        corners[i] = corner;
+        usedCorners |= 1u << corner;
+    }
+    if (usedCorners != 0xF) {
+        return false;
+    }
+
+    // corners add up to 6, so each triangle is missing the one that's left, those have to be opposite
+    uint32_t missing[2];
+    for (size_t t = 0; t < 2; ++t) {
+        const ae_uint16_t* tri = mesh->indices + t * 3;
+        if (tri[0] >= 4 || tri[1] >= 4 || tri[2] >= 4 || tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2]) {
+            return false;
+        }
+        missing[t] = 6 - corners[tri[0]] - corners[tri[1]] - corners[tri[2]];
+    }
+    return (missing[0] ^ missing[1]) == 3;
+}
+
+static bool IsSameState(const DrawList::State& a, const DrawList::State& b) {
+    return a.textureRGB == b.textureRGB &&
+           a.textureA == b.textureA &&
+           a.shading == b.shading &&
+           a.blendMode == b.blendMode &&
+           a.alphaMode == b.alphaMode;
+}
+
+
+DrawList::DrawList()
+    : mMultiTexture(false)
+    , mReorder(false)
+    , mParallelPack(false)
+    , mCache(nullptr)
+    , mCacheFrameIdx(0)
+    , mInstancing(false)
+    , mCulling(false)
+    , mWireframe(false)
+    , mUnifiedBlend(false)
+    , mCullBounds()
+    , mMaxTextures(2)
+    , mMaxVertices(0)
+    , mMaxIndices(0)
+    , mNumMeshes(0)
+    , mNumReorderedMeshes(0)
+    , mNumPackVertices(0)
+{
+}
+DrawList::~DrawList() {
+}
+
+void DrawList::Reset(const bool multiTexture, const size_t maxTextures, const size_t maxVertices, const size_t maxIndices, const bool reorder, const bool parallelPack, GeometryCache* cache, const bool instancing) {
+    // we keep the capacity, so after the first frame there are no allocations
+    mVertices.clear();
+    mIndices.clear();
+    mRecords.clear();
+    mDrawData.clear();
+    mTextures.clear();
+    mInstances.clear();
+    mMeshes.clear();
+    mNarrowIndices.clear();
+    mWideIndices.clear();
+    mPackJobs.clear();
+    mNumPackVertices = 0;
+
+    mMultiTexture = multiTexture;
+    mReorder = reorder;
+    mParallelPack = parallelPack;
+    mCache = cache;
+    mCacheFrameIdx = cache ? cache->GetFrameIdx() : 0;
+    // instanced meshes live in the cache
+    mInstancing = instancing && cache;
+    mMaxTextures = std::max<size_t>(maxTextures, 2);
+    // a part has to fit at least one triangle
+    mMaxVertices = std::max<size_t>(maxVertices, 3);
+    mMaxIndices = std::max<size_t>(maxIndices, 3);
+    mNumMeshes = 0;
+    mNumReorderedMeshes = 0;
+    mNumInstancedMeshes = 0;
+    mNumCulledMeshes = 0;
+    mNumInvisibleMeshes = 0;
+    mCulling = false;
+    mWireframe = false;
+    mUnifiedBlend = false;
+}
+
+void DrawList::SetCullBounds(const Bounds& visible) {
+    mCullBounds = visible;
+    mCulling = true;
+}
+
+void DrawList::SetWireframe(const bool wireframe) {
+    mWireframe = wireframe;
+    if (wireframe) {
+        mCache = nullptr;
+        mInstancing = false;
+    }
+}
+
+void DrawList::SetUnifiedBlend(const bool unified) {
+    mUnifiedBlend = unified;
+}
+
+void DrawList::AddMesh(const aeMovieRenderMesh* mesh, const void* key, const Shading shading, const GLuint textureRGB, const GLuint textureA, const bool premultAlpha, const float* uvAffine) {
+    // nothing of these would reach the screen, so they don't get to cost any packing or uploads
+    if (mesh->opacity <= 0.0f) {
+        ++mNumInvisibleMeshes;
+        return;
+    }
+    if (mCulling && !IsBoundsOverlap(CalcMeshBounds(mesh, nullptr, mesh->vertexCount), mCullBounds)) {
+        ++mNumCulledMeshes;
+        return;
+    }
+
+    State state;
+    // the multi-texture shader always samples, no point in splitting records over solid meshes
+    state.shading = (mMultiTexture && shading == Shading::Solid) ? Shading::Texture : shading;
+    state.textureRGB = (mMultiTexture || state.shading == Shading::Solid) ? 0 : textureRGB;
+    state.textureA = (mMultiTexture || state.shading != Shading::TextureMatte) ? 0 : textureA;
+    state.blendMode = (mesh->blend_mode == AE_MOVIE_BLEND_ADD) ? BlendMode::Add : BlendMode::Normal;
+    state.alphaMode = premultAlpha ? AlphaMode::Premultiplied : AlphaMode::Straight;
+
+    uint32_t drawFlags = 0;
+    if (mUnifiedBlend) {
+        drawFlags |= (state.alphaMode == AlphaMode::Straight) ? kDrawFlagStraightAlpha : 0;
+        drawFlags |= (state.blendMode == BlendMode::Add) ? kDrawFlagAdditive : 0;
+        state.blendMode = BlendMode::Normal;
+        state.alphaMode = AlphaMode::Unified;
+    }
+
+    // matte uvs come from the position, instances have none
+    if (mInstancing && state.shading != Shading::TextureMatte && this->AddInstance(mesh, key, state, drawFlags, textureRGB)) {
+        ++mNumInstancedMeshes;
+        ++mNumMeshes;
+        return;
+    }
+
+    // resident vertices can't be split, the mesh just gets a record of its own if it's too big,
+    // wireframe meshes always go the split way, as that unshares the vertices
+    const bool resident = mCache && key;
+    if (!mWireframe && (resident || (mesh->vertexCount <= mMaxVertices && mesh->indexCount <= mMaxIndices))) {
+        this->AddMeshPart(mesh, key, state, drawFlags, textureRGB, textureA, uvAffine, nullptr, mesh->vertexCount, nullptr, mesh->indexCount);
+    } else {
+        this->SplitMesh(mesh, state, drawFlags, textureRGB, textureA, uvAffine);
+    }
+
+    ++mNumMeshes;
+}
+
+void DrawList::Finish() {
+    // cache first, resident jobs take the uv rects from it
+    if (mCache) {
+        mCache->PackDirty(mParallelPack && mCache->GetStaging().size() >= kMinParallelPackVertices);
+    }
+
+    // offsets of every job are known by now, so the meshes can be packed in any order
+    if (mParallelPack && mNumPackVertices >= kMinParallelPackVertices) {
+        ThreadPool::Instance().ParallelFor(mPackJobs.size(), [this](const size_t idx) {
+            this->RunPackJob(mPackJobs[idx]);
+        });
+    } else {
+        for (const PackJob& job : mPackJobs) {
+            this->RunPackJob(job);
+        }
+    }
+    mPackJobs.clear();
+    mNumPackVertices = 0;
+
+    mNarrowIndices.clear();
+    mWideIndices.clear();
+
+    const bool reordered = (mNumReorderedMeshes > 0);
+    if (reordered) {
+        mSortedVertices.resize(mVertices.size());
+        mSortedInstances.resize(mInstances.size());
+    }
+
+    uint32_t numVertices = 0;
+    uint32_t numInstances = 0;
+    for (Record& record : mRecords) {
+        // the record index width is only known once it's complete, resident indices are absolute
+        record.wideIndices = record.resident || (record.numVertices > kMaxNarrowVertices);
+
+        const size_t firstIndex = record.wideIndices ? mWideIndices.size() : mNarrowIndices.size();
+        if (record.wideIndices) {
+            mWideIndices.resize(firstIndex + record.numIndices);
+        } else {
+            mNarrowIndices.resize(firstIndex + record.numIndices);
+        }
+
+        if (reordered) {
+            // indices are already relative to the record, so a plain copy is enough
+            size_t numIndices = 0;
+            record.firstVertex = numVertices;
+            record.firstInstance = numInstances;
+            for (uint32_t meshIdx = record.firstMesh; meshIdx != kInvalidMesh; meshIdx = mMeshes[meshIdx].next) {
+                const MeshRef& ref = mMeshes[meshIdx];
+                if (ref.instance != kInvalidInstance) {
+                    mSortedInstances[numInstances++] = mInstances[ref.instance];
+                }
+                memcpy(mSortedVertices.data() + numVertices, mVertices.data() + ref.firstVertex, ref.numVertices * sizeof(DrawVertex));
+                CopyIndices(mNarrowIndices, mWideIndices, record.wideIndices, firstIndex + numIndices, mIndices.data() + ref.firstIndex, ref.numIndices);
+                numVertices += ref.numVertices;
+                numIndices += ref.numIndices;
+            }
+        } else {
+            // nothing moved, the arena is already laid out record by record
+            CopyIndices(mNarrowIndices, mWideIndices, record.wideIndices, firstIndex, mIndices.data() + record.firstIndex, record.numIndices);
+        }
+
+        record.firstIndex = static_cast<uint32_t>(firstIndex);
+    }
+
+    if (reordered) {
+        mVertices.swap(mSortedVertices);
+        mInstances.swap(mSortedInstances);
+    }
+}
+
+bool DrawList::IsMultiTexture() const {
+    return mMultiTexture;
+}
+
+bool DrawList::IsWireframe() const {
+    return mWireframe;
+}
+
+bool DrawList::IsUnifiedBlend() const {
+    return mUnifiedBlend;
+}
+
+GeometryCache* DrawList::GetGeometryCache() const {
+    return mCache;
+}
+
+uint64_t DrawList::GetCacheFrameIdx() const {
+    return mCacheFrameIdx;
+}
+
+size_t DrawList::GetNumMeshes() const {
+    return mNumMeshes;
+}
+
+size_t DrawList::GetNumReorderedMeshes() const {
+    return mNumReorderedMeshes;
+}
+
+size_t DrawList::GetNumInstancedMeshes() const {
+    return mNumInstancedMeshes;
+}
+
+size_t DrawList::GetNumCulledMeshes() const {
+    return mNumCulledMeshes;
+}
+
+size_t DrawList::GetNumInvisibleMeshes() const {
+    return mNumInvisibleMeshes;
+}
+
+const std::vector<DrawVertex>& DrawList::GetVertices() const {
+    return mVertices;
+}
+
+const std::vector<uint16_t>& DrawList::GetNarrowIndices() const {
+    return mNarrowIndices;
+}
+
+const std::vector<uint32_t>& DrawList::GetWideIndices() const {
+    return mWideIndices;
+}
+
+const std::vector<DrawData>& DrawList::GetDrawData() const {
+    return mDrawData;
+}
+
+const std::vector<DrawList::Record>& DrawList::GetRecords() const {
+    return mRecords;
+}
+
+const std::vector<GLuint>& DrawList::GetTextures() const {
+    return mTextures;
+}
+
+const std::vector<DrawInstance>& DrawList::GetInstances() const {
+    return mInstances;
+}
+
+void DrawList::SplitMesh(const aeMovieRenderMesh* mesh, const State& state, const uint32_t drawFlags, const GLuint textureRGB, const GLuint textureA, const float* uvAffine) {
+    mSplitRemap.assign(mesh->vertexCount, kInvalidVertex);
+
+    // whole triangles go into parts until either limit is hit, only the vertices a part
+    // references are copied, so shared vertices on the cut are duplicated
+    // in wireframe lists no vertex is shared at all, vertex i of a part is then corner i % 3
+    const bool unshared = mWireframe;
+    const uint32_t numTriangleIndices = mesh->indexCount - mesh->indexCount % 3;
+    uint32_t index = 0;
+    while (index < numTriangleIndices) {
+        mSplitVertices.clear();
+        mSplitIndices.clear();
+
+        for (; index < numTriangleIndices; index += 3) {
+            size_t newVertices = unshared ? 3 : 0;
+            for (uint32_t i = 0; i < 3 && !unshared; ++i) {
+                if (mSplitRemap[mesh->indices[index + i]] == kInvalidVertex) {
+                    ++newVertices;
+                }
+            }
+
+            if (mSplitVertices.size() + newVertices > mMaxVertices || mSplitIndices.size() + 3 > mMaxIndices) {
+                break;
+            }
+
+            for (uint32_t i = 0; i < 3; ++i) {
+                const uint32_t meshVertex = mesh->indices[index + i];
+                if (unshared) {
+                    mSplitIndices.push_back(static_cast<uint32_t>(mSplitVertices.size()));
+                    mSplitVertices.push_back(meshVertex);
+                    continue;
+                }
+                uint32_t& partVertex = mSplitRemap[meshVertex];
+                if (partVertex == kInvalidVertex) {
+                    partVertex = static_cast<uint32_t>(mSplitVertices.size());
+                    mSplitVertices.push_back(meshVertex);
+                }
+                mSplitIndices.push_back(partVertex);
+            }
+        }
+
+        this->AddMeshPart(mesh, nullptr, state, drawFlags, textureRGB, textureA, uvAffine,
+                          mSplitVertices.data(), static_cast<uint32_t>(mSplitVertices.size()),
+                          mSplitIndices.data(), static_cast<uint32_t>(mSplitIndices.size()));
+
+        for (const uint32_t meshVertex : mSplitVertices) {
+            mSplitRemap[meshVertex] = kInvalidVertex;
+        }
+    }
+}
+
+void DrawList::AddMeshPart(const aeMovieRenderMesh* mesh, const void* key, const State& state, const uint32_t drawFlags, const GLuint textureRGB, const GLuint textureA, const float* uvAffine,
+                           const uint32_t* vertexMap, const uint32_t numVertices, const uint32_t* indices, const uint32_t numIndices) {
+    const Bounds bounds = mReorder ? CalcMeshBounds(mesh, vertexMap, numVertices) : Bounds();
+
+    // meshes without a key would all share one entry, so they're packed into the arena like without a cache
+    const bool resident = mCache && key;
+
+    size_t recordIdx = this->FindRecord(numVertices, numIndices, state, textureRGB, textureA, nullptr, resident, bounds);
+    if (recordIdx == mRecords.size()) {
+        recordIdx = this->BeginRecord(state, resident);
+    } else if (recordIdx + 1 != mRecords.size()) {
+        ++mNumReorderedMeshes;
+    }
+
+    Record& record = mRecords[recordIdx];
+
+    uint8_t slotRGB = 0, slotA = 0;
+    if (mMultiTexture) {
+        slotRGB = this->AddRecordTexture(record, textureRGB);
+        if (state.shading == Shading::TextureMatte) {
+            slotA = this->AddRecordTexture(record, textureA);
+        }
+    }
+
+    const GeometryCache::Entry* entry = resident ? &mCache->Update(key, mesh, false) : nullptr;
+    // resident meshes take no room in the arena
+    const uint32_t numArenaVertices = entry ? 0 : numVertices;
+
+    const size_t firstVertex = mVertices.size();
+    const size_t firstIndex = mIndices.size();
+    mVertices.resize(firstVertex + numArenaVertices);
+    mIndices.resize(firstIndex + numIndices);
+
+    PackJob job;
+    job.firstVertex = static_cast<uint32_t>(firstVertex);
+    job.numVertices = numVertices;
+    job.firstIndex = static_cast<uint32_t>(firstIndex);
+    job.numIndices = numIndices;
+    job.baseVertex = entry ? entry->firstVertex : record.numVertices;
+    if (entry) {
+        job.drawId = entry->drawId;
+    } else if (mCache) {
+        // the table is indexed by the cache's draw ids, so arena meshes borrow one from it too
+        job.drawId = mCache->AllocateFrameDrawId();
+    } else {
+        job.drawId = static_cast<uint32_t>(mDrawData.size());
+    }
+
+    if (entry) {
+        // the cache packs the vertices if they changed, indices are made here every frame
+        job.positions = nullptr;
+        job.uv = nullptr;
+        job.uvRect = entry->uvRect;
+        job.meshIndices = mesh->indices;
+        job.partIndices = nullptr;
+        mPackJobs.push_back(job);
+    } else if (!vertexMap) {
+        // whole mesh, the streams go to the kernels as they are, so packing can wait for Finish
+        job.positions = reinterpret_cast<const float*>(mesh->position);
+        job.uv = reinterpret_cast<const float*>(mesh->uv);
+        job.uvRect = nullptr;
+        job.meshIndices = mesh->indices;
+        job.partIndices = nullptr;
+        mPackJobs.push_back(job);
+        mNumPackVertices += numVertices;
+    } else {
+        // split part, gather the vertices it uses, the scratch is reused by the next part
+        // so this one is packed right away
+        mSplitPositions.resize(numVertices * 3);
+        mSplitUV.resize(numVertices * 2);
+        for (size_t v = 0; v < numVertices; ++v) {
+            const size_t i = vertexMap[v];
+            mSplitPositions[v * 3 + 0] = mesh->position[i][0];
+            mSplitPositions[v * 3 + 1] = mesh->position[i][1];
+            mSplitPositions[v * 3 + 2] = mesh->position[i][2];
+            mSplitUV[v * 2 + 0] = mesh->uv[i][0];
+            mSplitUV[v * 2 + 1] = mesh->uv[i][1];
+        }
+        job.positions = mSplitPositions.data();
+        job.uv = mSplitUV.data();
+        job.uvRect = nullptr;
+        job.meshIndices = nullptr;
+        job.partIndices = indices;
+    }
+
+    // uv rect is filled when the job runs
+    DrawData drawData;
+    drawData.color[0] = mesh->color.r;
+    drawData.color[1] = mesh->color.g;
+    drawData.color[2] = mesh->color.b;
+    drawData.color[3] = mesh->opacity;
+    if (state.shading == Shading::TextureMatte) {
+        memcpy(drawData.affineU, uvAffine + 0, 3 * sizeof(float));
+        memcpy(drawData.affineV, uvAffine + 3, 3 * sizeof(float));
+    } else {
+        drawData.affineU[0] = drawData.affineU[1] = drawData.affineU[2] = 0.0f;
+        drawData.affineV[0] = drawData.affineV[1] = drawData.affineV[2] = 0.0f;
+    }
+    drawData.affineU[3] = static_cast<float>(slotRGB | drawFlags);
+    drawData.affineV[3] = static_cast<float>(slotA);
+    if (mCache) {
+        // resident vertices carry the cache's draw id, so the table is indexed by it
+        if (job.drawId >= mDrawData.size()) {
+            mDrawData.resize(job.drawId + 1);
+        }
+        mDrawData[job.drawId] = drawData;
+    } else {
+        mDrawData.push_back(drawData);
+    }
+
+    if (vertexMap) {
+        this->RunPackJob(job);
+    }
+
+    if (mReorder) {
+        MeshRef ref;
+        ref.firstVertex = static_cast<uint32_t>(firstVertex);
+        ref.numVertices = numArenaVertices;
+        ref.firstIndex = static_cast<uint32_t>(firstIndex);
+        ref.numIndices = numIndices;
+        ref.instance = kInvalidInstance;
+        ref.bounds = bounds;
+        this->AddRecordMesh(record, ref);
+    }
+
+    record.numVertices += numVertices;
+    record.numIndices += numIndices;
+}
+
+bool DrawList::AddInstance(const aeMovieRenderMesh* mesh, const void* key, const State& state, const uint32_t drawFlags, const GLuint textureRGB) {
+    DrawInstance instance;
+    CalcUVRect(reinterpret_cast<const float*>(mesh->uv), mesh->vertexCount, instance.uvRect);
+
+    float affine[6];
+    if (!FitLocalAffine(mesh, instance.uvRect, affine)) {
+        return false;
+    }
+
+    // quads all share the unit one, so runs of them become a single draw,
+    // anything else keeps its own local mesh under the layer key
+    const bool unitQuad = IsUnitQuad(mesh, instance.uvRect);
+    const void* meshKey = unitQuad ? &kUnitQuadKey : key;
+    const aeMovieRenderMesh* localMesh = unitQuad ? &GetUnitQuadMesh() : mesh;
+    if (!meshKey) {
+        return false;
+    }
+
+    const Bounds bounds = mReorder ? CalcMeshBounds(mesh, nullptr, mesh->vertexCount) : Bounds();
+
+    size_t recordIdx = this->FindRecord(0, 0, state, textureRGB, 0, meshKey, true, bounds);
+    const bool newRecord = (recordIdx == mRecords.size());
+    if (newRecord) {
+        recordIdx = this->BeginRecord(state, true);
+    } else if (recordIdx + 1 != mRecords.size()) {
+        ++mNumReorderedMeshes;
+    }
+
+    Record& record = mRecords[recordIdx];
+
+    const size_t firstIndex = mIndices.size();
+    uint32_t numVertices = 0, numIndices = 0;
+    if (newRecord) {
+        // the mesh goes in once, with indices pointing into the resident buffer
+        const GeometryCache::Entry& entry = mCache->Update(meshKey, localMesh, true);
+        numVertices = localMesh->vertexCount;
+        numIndices = localMesh->indexCount;
+        mIndices.resize(firstIndex + numIndices);
+
+        PackJob job;
+        job.positions = nullptr;
+        job.uv = nullptr;
+        job.uvRect = nullptr;
+        job.meshIndices = localMesh->indices;
+        job.partIndices = nullptr;
+        job.firstVertex = 0;
+        job.numVertices = numVertices;
+        job.firstIndex = static_cast<uint32_t>(firstIndex);
+        job.numIndices = numIndices;
+        job.baseVertex = entry.firstVertex;
+        job.drawId = 0;
+        mPackJobs.push_back(job);
+
+        record.instancedMesh = meshKey;
+    }
+
+    memcpy(instance.affineX, affine + 0, 3 * sizeof(float));
+    memcpy(instance.affineY, affine + 3, 3 * sizeof(float));
+    instance.color[0] = mesh->color.r;
+    instance.color[1] = mesh->color.g;
+    instance.color[2] = mesh->color.b;
+    instance.color[3] = mesh->opacity;
+    instance.slot = (mMultiTexture ? this->AddRecordTexture(record, textureRGB) : 0) | drawFlags;
+
+    const uint32_t instanceIdx = static_cast<uint32_t>(mInstances.size());
+    mInstances.push_back(instance);
+
+    if (mReorder) {
+        MeshRef ref;
+        ref.firstVertex = static_cast<uint32_t>(mVertices.size());
+        ref.numVertices = 0;
+        ref.firstIndex = static_cast<uint32_t>(firstIndex);
+        ref.numIndices = numIndices;
+        ref.instance = instanceIdx;
+        ref.bounds = bounds;
+        this->AddRecordMesh(record, ref);
+    }
+
+    record.numVertices += numVertices;
+    record.numIndices += numIndices;
+    ++record.numInstances;
+
+    return true;
+}
+
+void DrawList::AddRecordMesh(Record& record, const MeshRef& ref) {
+    const uint32_t meshIdx = static_cast<uint32_t>(mMeshes.size());
+    if (record.firstMesh == kInvalidMesh) {
+        record.firstMesh = meshIdx;
+        record.bounds = ref.bounds;
+    } else {
+        mMeshes[record.lastMesh].next = meshIdx;
+        MergeBounds(record.bounds, ref.bounds);
+    }
+    record.lastMesh = meshIdx;
+
+    mMeshes.push_back(ref);
+    mMeshes.back().next = kInvalidMesh;
+}
+
+// jobs only write their own slices of the arenas and their own DrawData, so they may run in parallel
+void DrawList::RunPackJob(const PackJob& job) {
+    if (job.positions) {
+        VertexPackSource src;
+        src.positions = job.positions;
+        src.uv = job.uv;
+        src.drawId = job.drawId;
+        CalcUVRect(src.uv, job.numVertices, src.uvRect);
+        memcpy(mDrawData[job.drawId].uvRect, src.uvRect, sizeof(src.uvRect));
+
+        DrawVertex* dst = mVertices.data() + job.firstVertex;
+        PackVertices(dst, src, job.numVertices);
+        if (mWireframe) {
+            for (uint32_t v = 0; v < job.numVertices; ++v) {
+                dst[v].drawId |= (v % 3) << kWireCornerShift;
+            }
+        }
+    } else if (job.uvRect) {
+        memcpy(mDrawData[job.drawId].uvRect, job.uvRect, sizeof(mDrawData[job.drawId].uvRect));
+    }
+
+    uint32_t* dstIndices = mIndices.data() + job.firstIndex;
+    if (job.partIndices) {
+        for (size_t i = 0; i < job.numIndices; ++i) {
+            dstIndices[i] = job.partIndices[i] + job.baseVertex;
+        }
+    } else {
+        for (size_t i = 0; i < job.numIndices; ++i) {
+            dstIndices[i] = job.meshIndices[i] + job.baseVertex;
+        }
+    }
+}
+
+// returns mRecords.size() if the mesh needs a new record
+size_t DrawList::FindRecord(const uint32_t numVertices, const uint32_t numIndices, const State& state, const GLuint textureRGB, const GLuint textureA, const void* instancedMesh, const bool resident, const Bounds& bounds) const {
+    if (mRecords.empty()) {
+        return mRecords.size();
+    }
+
+    size_t recordIdx = mRecords.size() - 1;
+    if (this->CanJoinRecord(mRecords[recordIdx], numVertices, numIndices, state, textureRGB, textureA, instancedMesh, resident)) {
+        return recordIdx;
+    }
+
+    if (mReorder) {
+        // painter's order only matters where meshes overlap, so we can move past
+        // every record we don't touch and join the first compatible one before them
+        const size_t lastIdx = recordIdx;
+        while (recordIdx > 0 && lastIdx - recordIdx < kMaxReorderDistance) {
+            if (this->OverlapsRecord(mRecords[recordIdx], bounds)) {
+                break;
+            }
+
+            --recordIdx;
+            if (this->CanJoinRecord(mRecords[recordIdx], numVertices, numIndices, state, textureRGB, textureA, instancedMesh, resident)) {
+                return recordIdx;
+            }
+        }
+    }
+
+    return mRecords.size();
+}
+
+bool DrawList::CanJoinRecord(const Record& record, const uint32_t numVertices, const uint32_t numIndices, const State& state, const GLuint textureRGB, const GLuint textureA, const void* instancedMesh, const bool resident) const {
+    // instances only join the draw of their own mesh, resident and arena meshes use different buffers
+    if (record.instancedMesh != instancedMesh ||
+        record.resident != resident ||
+        !IsSameState(record.state, state) ||
+        record.numVertices + numVertices > mMaxVertices ||
+        record.numIndices + numIndices > mMaxIndices) {
+        return false;
+    }
+
+    if (mMultiTexture) {
+        // different textures can share the record as long as we have free sampler units left
+        size_t texturesToAdd = 0;
+        if (!this->HasRecordTexture(record, textureRGB)) {
+            ++texturesToAdd;
+        }
+        if (state.shading == Shading::TextureMatte && textureA != textureRGB && !this->HasRecordTexture(record, textureA)) {
+            ++texturesToAdd;
+        }
+
+        return record.numTextures + texturesToAdd <= mMaxTextures;
+    }
+
+    return true;
+}
+
+bool DrawList::OverlapsRecord(const Record& record, const Bounds& bounds) const {
+    if (!IsBoundsOverlap(record.bounds, bounds)) {
+        return false;
+    }
+
+    // the record bounds are just a quick reject, scattered meshes may still leave room in between
+    for (uint32_t meshIdx = record.firstMesh; meshIdx != kInvalidMesh; meshIdx = mMeshes[meshIdx].next) {
+        if (IsBoundsOverlap(mMeshes[meshIdx].bounds, bounds)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+size_t DrawList::BeginRecord(const State& state, const bool resident) {
+    Record record;
+    record.state = state;
+    record.firstVertex = static_cast<uint32_t>(mVertices.size());
+    record.numVertices = 0;
+    record.firstIndex = static_cast<uint32_t>(mIndices.size());
+    record.numIndices = 0;
+    record.wideIndices = false;
+    record.resident = resident;
+    // every record owns a fixed range of texture slots, so earlier records can still grow when reordering
+    record.firstTexture = static_cast<uint32_t>(mTextures.size());
+    record.numTextures = 0;
+    record.instancedMesh = nullptr;
+    record.firstInstance = static_cast<uint32_t>(mInstances.size());
+    record.numInstances = 0;
+    record.bounds = Bounds();
+    record.firstMesh = kInvalidMesh;
+    record.lastMesh = kInvalidMesh;
+
+    if (mMultiTexture) {
+        mTextures.resize(mTextures.size() + mMaxTextures, 0);
+    }
+
+    mRecords.push_back(record);
+    return mRecords.size() - 1;
+}
+
+uint8_t DrawList::AddRecordTexture(Record& record, const GLuint texture) {
+    const GLuint* begin = mTextures.data() + record.firstTexture;
+    const GLuint* end = begin + record.numTextures;
+    const GLuint* it = std::find(begin, end, texture);
+    if (it == end) {
+        mTextures[record.firstTexture + record.numTextures] = texture;
+        ++record.numTextures;
+    }
+    return static_cast<uint8_t>(it - begin);
+}
+
+bool DrawList::HasRecordTexture(const Record& record, const GLuint texture) const {
+    const GLuint* begin = mTextures.data() + record.firstTexture;
+    const GLuint* end = begin + record.numTextures;
+    return std::find(begin, end, texture) != end;
+}
@@ -0,0 +1,243 @@
+#pragma once
+#include <glad/glad.h>
+#include <cstdint>
+#include <vector>
+
+struct aeMovieRenderMesh;
+class GeometryCache;
+
+// compact vertex, everything constant across a mesh lives in its DrawData
+struct DrawVertex {
+    float    pos[2];
+    uint16_t uv[2];     // unorm16 within DrawData::uvRect
+    uint32_t drawId;    // index into the per-draw table, wireframe lists keep the triangle corner in the top bits
+};
+
+// per-draw table entry, one per mesh (or mesh part), read by the vertex shader
+// track matte draws get the rgb uv from the position through the affine:
+//   u = affineU.x + affineU.y * pos.x + affineU.z * pos.y, same for v with affineV
+// and sample the matte with the vertex uv
+struct DrawData {
+    float    color[4];      // rgb + opacity
+    float    uvRect[4];     // min.xy, extent.xy
+    float    affineU[4];    // w: rgb texture slot + draw flags
+    float    affineV[4];    // w: alpha texture slot
+};
+
+// per-instance record of the instanced path, the instanced mesh is resident in the GeometryCache
+// and its vertex uv (local, 0..1 within uvRect) is the point the affine maps to the position:
+//   pos.x = affineX[0] + affineX[1] * u + affineX[2] * v, same for y with affineY
+struct DrawInstance {
+    float    affineX[3];
+    float    affineY[3];
+    float    uvRect[4];     // min.xy, extent.xy
+    float    color[4];      // rgb + opacity
+    uint32_t slot;          // rgb texture slot + draw flags
+};
+
+// CPU side of the composition rendering: vertex/index arena plus a compact list of draw records.
+// Filling it touches no GL state, so it can be built on any thread and submitted later on the GL one.
+class DrawList {
+public:
+    enum class BlendMode : uint8_t {
+        Normal,
+        Add
+    };
+
+    // picks the shader permutation, so the common cases don't pay for samplers they don't use
+    enum class Shading : uint8_t {
+        Solid,          // vertex color only, no textures
+        Texture,        // rgb texture
+        TextureMatte    // rgb texture + track matte alpha
+    };
+    static const size_t kNumShadings = 3;
+
+    // how the shader treats the texture alpha, picks the other half of the permutation
+    enum class AlphaMode : uint8_t {
+        Straight,
+        Premultiplied,
+        Unified         // always outputs premultiplied, so Normal & Add share one blend func
+    };
+    static const size_t kNumAlphaModes = 3;
+
+    // unified lists keep the per-mesh alpha & blend in the rgb slot value, above its 8 bits
+    static const uint32_t kDrawFlagStraightAlpha = 1u << 8;    // texture isn't premultiplied, the shader does it
+    static const uint32_t kDrawFlagAdditive = 1u << 9;         // goes out with alpha 0, so it's added
+
+    // drawId bits above this hold the corner of the vertex in its triangle (0..2), wireframe lists only
+    static const uint32_t kWireCornerShift = 30;
+
+    // everything that forces a batch break
+    struct State {
+        GLuint      textureRGB;     // 0 in multi-texture mode, textures are in the record's table
+        GLuint      textureA;       // 0 unless shading is TextureMatte
+        Shading     shading;
+        BlendMode   blendMode;      // always Normal in unified lists
+        AlphaMode   alphaMode;
+    };
+
+    // axis aligned bounds in composition space, which maps to the screen by uniform scale + offset
+    struct Bounds {
+        float       minX, minY;
+        float       maxX, maxY;
+    };
+
+    // indices of a record are relative to its first vertex, records with more than 64K vertices
+    // keep theirs in the wide (32-bit) arena, firstIndex points into the arena the record uses
+    // instanced records draw their one resident mesh numInstances times, with absolute indices
+    struct Record {
+        State       state;
+        uint32_t    firstVertex;
+        uint32_t    numVertices;
+        uint32_t    firstIndex;
+        uint32_t    numIndices;
+        bool        wideIndices;
+        bool        resident;       // indices are absolute, into the cache's resident buffer, the arena isn't used
+        uint32_t    firstTexture;
+        uint32_t    numTextures;
+        const void* instancedMesh;  // cache key of the mesh, null for regular records
+        uint32_t    firstInstance;
+        uint32_t    numInstances;
+        // reordering data, meshes of the record form a singly linked list
+        Bounds      bounds;
+        uint32_t    firstMesh;
+        uint32_t    lastMesh;
+    };
+
+    DrawList();
+    ~DrawList();
+
+    // meshes bigger than maxVertices / maxIndices are split at triangle boundaries
+    // with `reorder` a mesh may join an earlier compatible record, as long as it doesn't overlap
+    // anything drawn in between, so the result stays pixel-identical to the painter's order
+    // with `parallelPack` Finish packs big lists on the ThreadPool
+    // with a `cache` the vertices are resident in it, the list then only has the indices, which point
+    // straight into the resident buffer (so they are always wide), and meshes are never split,
+    // meshes without a key can't be cached, they still go to the arena, in records of their own
+    // with `instancing` (needs the cache) quads and meshes that only move as a whole become instances,
+    // quads all share one resident unit quad, other meshes keep their local shape in the cache
+    void        Reset(const bool multiTexture, const size_t maxTextures, const size_t maxVertices, const size_t maxIndices, const bool reorder, const bool parallelPack, GeometryCache* cache, const bool instancing);
+    // meshes entirely outside `visible` are dropped by AddMesh, before anything is packed, until the next Reset
+    void        SetCullBounds(const Bounds& visible);
+    // with `wireframe` every triangle gets its own three vertices, their corners go to the drawId top bits
+    // so the shaders can draw the edges, the list can't be cached or instanced then, so it drops both
+    void        SetWireframe(const bool wireframe);
+    // with `unified` every record is Unified & Normal, the mesh's own alpha & blend mode go to its draw flags,
+    // so mixed Normal/Add and straight/premultiplied stacks still batch
+    void        SetUnifiedBlend(const bool unified);
+    // in multi-texture mode Solid is drawn as Texture, so textureRGB has to be valid (white) then
+    // uvAffine (as made by CalcUVAffine) is only used, and required, for TextureMatte
+    // `key` identifies the layer in the geometry cache, required when there is one
+    // only the placement is decided here, the mesh streams are read by Finish, so they have to stay valid till then
+    // fully transparent meshes are dropped right away
+    void        AddMesh(const aeMovieRenderMesh* mesh, const void* key, const Shading shading, const GLuint textureRGB, const GLuint textureA, const bool premultAlpha, const float* uvAffine);
+    // packs the meshes, lays the arena out record by record and picks index widths, must be called after the last AddMesh
+    void        Finish();
+
+    bool        IsMultiTexture() const;
+    bool        IsWireframe() const;
+    bool        IsUnifiedBlend() const;
+    GeometryCache* GetGeometryCache() const;
+    // GeometryCache::GetFrameIdx at Reset, the resident ranges are only valid while the cache is still at it
+    uint64_t    GetCacheFrameIdx() const;
+    size_t      GetNumMeshes() const;
+    size_t      GetNumReorderedMeshes() const;
+    size_t      GetNumInstancedMeshes() const;
+    size_t      GetNumCulledMeshes() const;
+    size_t      GetNumInvisibleMeshes() const;
+
+    const std::vector<DrawVertex>&  GetVertices() const;
+    const std::vector<DrawData>&    GetDrawData() const;
+    const std::vector<uint16_t>&    GetNarrowIndices() const;
+    const std::vector<uint32_t>&    GetWideIndices() const;
+    const std::vector<Record>&      GetRecords() const;
+    const std::vector<GLuint>&      GetTextures() const;
+    const std::vector<DrawInstance>& GetInstances() const;
+
+private:
+    // mesh conversion with its arena slices, known as soon as the mesh is placed
+    struct PackJob {
+        const float*        positions;      // null for resident meshes, only their indices are made
+        const float*        uv;
+        const float*        uvRect;         // resident meshes take theirs from the cache
+        const uint16_t*     meshIndices;    // whole mesh
+        const uint32_t*     partIndices;    // split part
+        uint32_t            firstVertex;
+        uint32_t            numVertices;
+        uint32_t            firstIndex;
+        uint32_t            numIndices;
+        uint32_t            baseVertex;     // added to the indices, they're relative to the record
+        uint32_t            drawId;
+    };
+
+    struct MeshRef {
+        uint32_t    next;
+        uint32_t    firstVertex;
+        uint32_t    numVertices;
+        uint32_t    firstIndex;
+        uint32_t    numIndices;
+        uint32_t    instance;       // kInvalidInstance for meshes
+        Bounds      bounds;
+    };
+
+    void        SplitMesh(const aeMovieRenderMesh* mesh, const State& state, const uint32_t drawFlags, const GLuint textureRGB, const GLuint textureA, const float* uvAffine);
+    // adds a part of the mesh, `vertexMap` maps part vertices to mesh ones and `indices` index the part,
+    // both null means the whole mesh
+    // with the geometry cache `key` is looked up in it, parts of split meshes have none
+    void        AddMeshPart(const aeMovieRenderMesh* mesh, const void* key, const State& state, const uint32_t drawFlags, const GLuint textureRGB, const GLuint textureA, const float* uvAffine,
+                            const uint32_t* vertexMap, const uint32_t numVertices, const uint32_t* indices, const uint32_t numIndices);
+    // returns false if the mesh is no instance, it's added as a regular one then
+    bool        AddInstance(const aeMovieRenderMesh* mesh, const void* key, const State& state, const uint32_t drawFlags, const GLuint textureRGB);
+    // links the mesh into the record's list, only needed when reordering
+    void        AddRecordMesh(Record& record, const MeshRef& ref);
+    void        RunPackJob(const PackJob& job);
+    size_t      FindRecord(const uint32_t numVertices, const uint32_t numIndices, const State& state, const GLuint textureRGB, const GLuint textureA, const void* instancedMesh, const bool resident, const Bounds& bounds) const;
+    bool        CanJoinRecord(const Record& record, const uint32_t numVertices, const uint32_t numIndices, const State& state, const GLuint textureRGB, const GLuint textureA, const void* instancedMesh, const bool resident) const;
+    bool        OverlapsRecord(const Record& record, const Bounds& bounds) const;
+    size_t      BeginRecord(const State& state, const bool resident);
+    uint8_t     AddRecordTexture(Record& record, const GLuint texture);
+    bool        HasRecordTexture(const Record& record, const GLuint texture) const;
+
+private:
+    std::vector<DrawVertex> mVertices;
+    std::vector<DrawData>   mDrawData;
+    std::vector<uint32_t>   mIndices;           // built in full width, Finish narrows them
+    std::vector<Record>     mRecords;
+    std::vector<GLuint>     mTextures;
+    std::vector<DrawInstance> mInstances;
+    std::vector<MeshRef>    mMeshes;
+    std::vector<PackJob>    mPackJobs;          // whole meshes waiting for Finish
+    // final index arenas, filled by Finish
+    std::vector<uint16_t>   mNarrowIndices;
+    std::vector<uint32_t>   mWideIndices;
+    // arena copies used by Finish to lay out reordered records
+    std::vector<DrawVertex> mSortedVertices;
+    std::vector<DrawInstance> mSortedInstances;
+    // split scratch: mesh vertex -> part vertex, part vertex -> mesh vertex, part indices
+    std::vector<uint32_t>   mSplitRemap;
+    std::vector<uint32_t>   mSplitVertices;
+    std::vector<uint32_t>   mSplitIndices;
+    // vertex streams of a part, gathered so they can go through the packing kernels
+    std::vector<float>      mSplitPositions;
+    std::vector<float>      mSplitUV;
+
+    bool                    mMultiTexture;
+    bool                    mReorder;
+    bool                    mParallelPack;
+    GeometryCache*          mCache;
+    uint64_t                mCacheFrameIdx;
+    bool                    mInstancing;
+    bool                    mCulling;
+    bool                    mWireframe;
+    bool                    mUnifiedBlend;
+    Bounds                  mCullBounds;
+    size_t                  mMaxTextures;
+    size_t                  mMaxVertices;
+    size_t                  mMaxIndices;
+    size_t                  mNumMeshes;
+    size_t                  mNumReorderedMeshes;
+    size_t                  mNumInstancedMeshes;
+    size_t                  mNumCulledMeshes;
+    size_t                  mNumInvisibleMeshes;
+    size_t                  mNumPackVertices;
+};
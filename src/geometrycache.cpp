@@ -0,0 +1,231 @@
+#include "geometrycache.h"
+#include "vertexpack.h"
+#include "threadpool.h"
+
+#include <cstring>
+
+extern "C" {
+#include <movie/movie.h>
+}
+
+
+// below this much lost space compaction isn't worth re-uploading everything
+static const uint32_t kMinCompactVertices = 64 * 1024;
+
+// meshes are hashed every frame, so this has to be way cheaper than packing them,
+// four independent lanes keep the multiplies from serializing
+static uint64_t HashStream(const void* data, const size_t size, uint64_t hash) {
+    static const uint64_t kMul = 0x9E3779B97F4A7C15ull;
+
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    uint64_t lanes[4] = { hash, hash ^ 1, hash ^ 2, hash ^ 3 };
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (size_t l = 0; l < 4; ++l) {
+            uint64_t word;
+            memcpy(&word, bytes + i + l * 8, sizeof(word));
+            lanes[l] = (lanes[l] ^ word) * kMul;
+            lanes[l] ^= lanes[l] >> 29;
+        }
+    }
+    for (; i < size; ++i) {
+        lanes[0] = (lanes[0] ^ bytes[i]) * kMul;
+    }
+
+    for (size_t l = 0; l < 4; ++l) {
+        hash = (hash ^ lanes[l]) * kMul;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+// only what ends up in the vertices, color & co. live in the draw table
+// local meshes start from another seed, so switching between the two repacks the layer
+static uint64_t HashMesh(const aeMovieRenderMesh* mesh, const bool local) {
+    uint64_t hash = (local ? 0x84222325cbf29ce4ull : 0xcbf29ce484222325ull) ^ mesh->vertexCount;
+    if (!local) {
+        hash = HashStream(mesh->position, mesh->vertexCount * sizeof(ae_vector3_t), hash);
+    }
+    hash = HashStream(mesh->uv, mesh->vertexCount * sizeof(ae_vector2_t), hash);
+    return hash;
+}
+
+
+GeometryCache::GeometryCache()
+    : mNumDrawIds(0)
+    , mNumVertices(0)
+    , mNumLiveVertices(0)
+    , mFrameIdx(0)
+    , mStats()
+{
+}
+GeometryCache::~GeometryCache() {
+}
+
+void GeometryCache::BeginFrame() {
+    // pending uploads stay, the entries already count them as packed
+    mPackJobs.clear();
+    mStats = Stats();
+    ++mFrameIdx;
+
+    mFreeDrawIds.insert(mFreeDrawIds.end(), mFrameDrawIds.begin(), mFrameDrawIds.end());
+    mFrameDrawIds.clear();
+
+    // ranges are never moved, so once reallocations waste more than the layers use
+    // we start over and let this frame lay everything out densely again
+    const uint32_t wasted = mNumVertices - mNumLiveVertices;
+    if (wasted > kMinCompactVertices && wasted > mNumLiveVertices) {
+        this->Clear();
+    }
+}
+
+const GeometryCache::Entry& GeometryCache::Update(const void* key, const aeMovieRenderMesh* mesh, const bool local) {
+    const uint64_t hash = HashMesh(mesh, local);
+    const uint32_t numVertices = mesh->vertexCount;
+    const size_t bytes = numVertices * sizeof(DrawVertex);
+
+    EntriesTable::iterator it = mEntries.find(key);
+    if (it == mEntries.end()) {
+        Entry entry;
+        entry.hash = ~hash;     // anything but the hash, so it's packed below
+        entry.drawId = this->AllocateDrawId();
+        entry.firstVertex = 0;
+        entry.numVertices = 0;
+        entry.capacity = 0;
+        it = mEntries.emplace(key, entry).first;
+    }
+
+    Entry& entry = it->second;
+    if (entry.hash == hash) {
+        ++mStats.numReusedMeshes;
+        mStats.reusedBytes += bytes;
+        return entry;
+    }
+
+    if (numVertices > entry.capacity) {
+        // the old range is lost until the next compaction
+        mNumLiveVertices += numVertices - entry.capacity;
+        entry.firstVertex = mNumVertices;
+        entry.capacity = numVertices;
+        mNumVertices += numVertices;
+    }
+    entry.hash = hash;
+    entry.numVertices = numVertices;
+
+    PackJob job;
+    job.entry = &entry;
+    job.positions = reinterpret_cast<const float*>(mesh->position);
+    job.uv = reinterpret_cast<const float*>(mesh->uv);
+    job.stagingVertex = static_cast<uint32_t>(mStaging.size());
+    mPackJobs.push_back(job);
+
+    mStaging.resize(mStaging.size() + numVertices);
+
+    // new layers are allocated back to back, so their uploads usually merge into one
+    if (!mUploads.empty() &&
+        mUploads.back().firstVertex + mUploads.back().numVertices == entry.firstVertex &&
+        mUploads.back().stagingVertex + mUploads.back().numVertices == job.stagingVertex) {
+        mUploads.back().numVertices += numVertices;
+    } else {
+        Upload upload;
+        upload.firstVertex = entry.firstVertex;
+        upload.numVertices = numVertices;
+        upload.stagingVertex = job.stagingVertex;
+        mUploads.push_back(upload);
+    }
+
+    ++mStats.numUploadedMeshes;
+    mStats.uploadedBytes += bytes;
+
+    return entry;
+}
+
+void GeometryCache::PackDirty(const bool parallel) {
+    if (parallel) {
+        ThreadPool::Instance().ParallelFor(mPackJobs.size(), [this](const size_t idx) {
+            this->RunPackJob(mPackJobs[idx]);
+        });
+    } else {
+        for (const PackJob& job : mPackJobs) {
+            this->RunPackJob(job);
+        }
+    }
+    mPackJobs.clear();
+}
+
+void GeometryCache::Remove(const void* key) {
+    EntriesTable::iterator it = mEntries.find(key);
+    if (it != mEntries.end()) {
+        mNumLiveVertices -= it->second.capacity;
+        mFreeDrawIds.push_back(it->second.drawId);
+        mEntries.erase(it);
+    }
+}
+
+uint64_t GeometryCache::GetFrameIdx() const {
+    return mFrameIdx;
+}
+
+void GeometryCache::ClearUploads() {
+    mUploads.clear();
+    mStaging.clear();
+}
+
+uint32_t GeometryCache::AllocateFrameDrawId() {
+    const uint32_t drawId = this->AllocateDrawId();
+    mFrameDrawIds.push_back(drawId);
+    return drawId;
+}
+
+void GeometryCache::Clear() {
+    mEntries.clear();
+    mPackJobs.clear();
+    mUploads.clear();
+    mStaging.clear();
+    mFreeDrawIds.clear();
+    mFrameDrawIds.clear();
+    mNumDrawIds = 0;
+    mNumVertices = 0;
+    mNumLiveVertices = 0;
+}
+
+size_t GeometryCache::GetNumVertices() const {
+    return mNumVertices;
+}
+
+size_t GeometryCache::GetNumDrawIds() const {
+    return mNumDrawIds;
+}
+
+const std::vector<GeometryCache::Upload>& GeometryCache::GetUploads() const {
+    return mUploads;
+}
+
+const std::vector<DrawVertex>& GeometryCache::GetStaging() const {
+    return mStaging;
+}
+
+const GeometryCache::Stats& GeometryCache::GetStats() const {
+    return mStats;
+}
+
+void GeometryCache::RunPackJob(const PackJob& job) {
+    VertexPackSource src;
+    src.positions = job.positions;
+    src.uv = job.uv;
+    src.drawId = job.entry->drawId;
+    CalcUVRect(src.uv, job.entry->numVertices, src.uvRect);
+    memcpy(job.entry->uvRect, src.uvRect, sizeof(src.uvRect));
+
+    PackVertices(mStaging.data() + job.stagingVertex, src, job.entry->numVertices);
+}
+
+uint32_t GeometryCache::AllocateDrawId() {
+    if (!mFreeDrawIds.empty()) {
+        const uint32_t drawId = mFreeDrawIds.back();
+        mFreeDrawIds.pop_back();
+        return drawId;
+    }
+    return mNumDrawIds++;
+}
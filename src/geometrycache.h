@@ -0,0 +1,98 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "drawlist.h"
+
+struct aeMovieRenderMesh;
+
+// CPU side of the resident layer geometry, keyed by the node the layer got in OnProvideNode.
+// Every layer owns a range of a persistent vertex buffer and a persistent draw id, so its
+// packed vertices stay valid across frames. Each frame the mesh streams are hashed, only
+// new or changed layers are repacked into the staging arena and listed for upload.
+// Touches no GL state, the owner keeps the GL buffer at GetNumVertices(), applies the uploads
+// and then clears them. Entries take their new hash as soon as they're repacked, so uploads
+// stay pending until cleared, even across frames whose list was never drawn.
+class GeometryCache {
+public:
+    struct Entry {
+        uint64_t    hash;
+        uint32_t    drawId;
+        uint32_t    firstVertex;    // in the resident buffer
+        uint32_t    numVertices;
+        uint32_t    capacity;
+        float       uvRect[4];      // valid after PackDirty
+    };
+
+    // staging vertices that go to the resident buffer, consecutive ones are merged
+    struct Upload {
+        uint32_t    firstVertex;
+        uint32_t    numVertices;
+        uint32_t    stagingVertex;
+    };
+
+    struct Stats {
+        size_t      numReusedMeshes;
+        size_t      numUploadedMeshes;
+        size_t      reusedBytes;
+        size_t      uploadedBytes;
+    };
+
+    GeometryCache();
+    ~GeometryCache();
+
+    // starts the next list, compacts the buffer if too much of it went to waste, which drops the
+    // pending uploads too, as every layer is repacked then, ranges handed out before are invalid after that
+    void        BeginFrame();
+    // lists made before the last BeginFrame may point to ranges compaction gave away
+    uint64_t    GetFrameIdx() const;
+    // the mesh streams are only read by PackDirty, so they have to stay valid till then
+    // `local` meshes are only drawn as instances, their positions come from the instance affine,
+    // so they aren't hashed and a moving layer still hits the cache
+    const Entry& Update(const void* key, const aeMovieRenderMesh* mesh, const bool local);
+    // packs the layers Update found dirty
+    void        PackDirty(const bool parallel);
+    void        Remove(const void* key);
+    void        Clear();
+    // the uploads are in the resident buffer
+    void        ClearUploads();
+    // for a mesh that's drawn from the list's arena this time only, it's free again after the next BeginFrame
+    uint32_t    AllocateFrameDrawId();
+
+    // resident buffer has to hold at least that many vertices
+    size_t      GetNumVertices() const;
+    // draw table has to have at least that many entries
+    size_t      GetNumDrawIds() const;
+
+    const std::vector<Upload>&      GetUploads() const;
+    const std::vector<DrawVertex>&  GetStaging() const;
+    const Stats&                    GetStats() const;
+
+private:
+    struct PackJob {
+        Entry*          entry;
+        const float*    positions;
+        const float*    uv;
+        uint32_t        stagingVertex;
+    };
+
+    void        RunPackJob(const PackJob& job);
+    uint32_t    AllocateDrawId();
+
+private:
+    typedef std::unordered_map<const void*, Entry> EntriesTable;
+
+    EntriesTable            mEntries;
+    std::vector<PackJob>    mPackJobs;
+    std::vector<Upload>     mUploads;
+    std::vector<DrawVertex> mStaging;
+    std::vector<uint32_t>   mFreeDrawIds;
+    std::vector<uint32_t>   mFrameDrawIds;
+    uint32_t                mNumDrawIds;
+    uint32_t                mNumVertices;       // allocated from the resident buffer
+    uint32_t                mNumLiveVertices;   // owned by the entries, the rest is lost to reallocations
+    uint64_t                mFrameIdx;
+    Stats                   mStats;
+};
@@ -0,0 +1,240 @@
+#include "glstatecache.h"
+
+// can't match any real GL name or enum, so the first call always goes through
+static const GLuint kUnknownName = ~0u;
+static const GLenum kUnknownEnum = ~0u;
+static const size_t kUnknownUnit = ~size_t(0);
+
+
+GLStateCache::GLStateCache() {
+    mStats.numCalls = 0;
+    mStats.numFilteredCalls = 0;
+    mLastFrameStats = mStats;
+
+    this->Invalidate();
+}
+GLStateCache::~GLStateCache() {
+}
+
+void GLStateCache::Invalidate() {
+    mProgram = kUnknownName;
+    for (int& cap : mCaps) {
+        cap = -1;
+    }
+    for (GLenum& func : mBlendFunc) {
+        func = kUnknownEnum;
+    }
+    mBlendEquation = kUnknownEnum;
+    mActiveTexture = kUnknownUnit;
+    for (GLuint& texture : mTextures) {
+        texture = kUnknownName;
+    }
+    for (GLuint& texture : mBufferTextures) {
+        texture = kUnknownName;
+    }
+    mPolygonMode = kUnknownEnum;
+    mVertexArray = kUnknownName;
+    mArrayBuffer = kUnknownName;
+    mElementBuffer = kUnknownName;
+    mUniformBuffer = kUnknownName;
+    mPixelUnpackBuffer = kUnknownName;
+    for (GLuint& buffer : mUniformBindings) {
+        buffer = kUnknownName;
+    }
+}
+
+void GLStateCache::BeginFrame() {
+    mLastFrameStats = mStats;
+    mStats.numCalls = 0;
+    mStats.numFilteredCalls = 0;
+}
+
+const GLStateCache::Stats& GLStateCache::GetLastFrameStats() const {
+    return mLastFrameStats;
+}
+
+void GLStateCache::UseProgram(const GLuint program) {
+    if (!this->Filter(mProgram == program)) {
+        glUseProgram(program);
+        mProgram = program;
+    }
+}
+
+void GLStateCache::SetEnabled(const GLenum cap, const bool enable) {
+    size_t idx = NumCaps;
+    switch (cap) {
+        case GL_BLEND:          idx = CapBlend;       break;
+        case GL_CULL_FACE:      idx = CapCullFace;    break;
+        case GL_DEPTH_TEST:     idx = CapDepthTest;   break;
+        case GL_SCISSOR_TEST:   idx = CapScissorTest; break;
+    }
+
+    const int value = enable ? 1 : 0;
+    if (idx == NumCaps || !this->Filter(mCaps[idx] == value)) {
+        if (enable) {
+            glEnable(cap);
+        } else {
+            glDisable(cap);
+        }
+
+        if (idx != NumCaps) {
+            mCaps[idx] = value;
+        }
+    }
+}
+
+void GLStateCache::BlendFunc(const GLenum src, const GLenum dst) {
+    this->BlendFuncSeparate(src, dst, src, dst);
+}
+
+void GLStateCache::BlendFuncSeparate(const GLenum srcRGB, const GLenum dstRGB, const GLenum srcAlpha, const GLenum dstAlpha) {
+    const bool redundant = (mBlendFunc[0] == srcRGB && mBlendFunc[1] == dstRGB &&
+                            mBlendFunc[2] == srcAlpha && mBlendFunc[3] == dstAlpha);
+    if (!this->Filter(redundant)) {
+        glBlendFuncSeparate(srcRGB, dstRGB, srcAlpha, dstAlpha);
+        mBlendFunc[0] = srcRGB;
+        mBlendFunc[1] = dstRGB;
+        mBlendFunc[2] = srcAlpha;
+        mBlendFunc[3] = dstAlpha;
+    }
+}
+
+void GLStateCache::BlendEquation(const GLenum mode) {
+    if (!this->Filter(mBlendEquation == mode)) {
+        glBlendEquation(mode);
+        mBlendEquation = mode;
+    }
+}
+
+void GLStateCache::BindTexture(const size_t unit, const GLuint texture) {
+    if (unit >= kMaxTextureUnits) {
+        this->ActiveTexture(unit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+    } else if (!this->Filter(mTextures[unit] == texture)) {
+        this->ActiveTexture(unit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        mTextures[unit] = texture;
+    }
+}
+
+void GLStateCache::BindTextureBuffer(const size_t unit, const GLuint texture) {
+    if (unit >= kMaxTextureUnits) {
+        this->ActiveTexture(unit);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+    } else if (!this->Filter(mBufferTextures[unit] == texture)) {
+        this->ActiveTexture(unit);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        mBufferTextures[unit] = texture;
+    }
+}
+
+void GLStateCache::PolygonMode(const GLenum mode) {
+    if (!this->Filter(mPolygonMode == mode)) {
+        glPolygonMode(GL_FRONT_AND_BACK, mode);
+        mPolygonMode = mode;
+    }
+}
+
+void GLStateCache::BindVertexArray(const GLuint vao) {
+    if (!this->Filter(mVertexArray == vao)) {
+        glBindVertexArray(vao);
+        mVertexArray = vao;
+        // element buffer binding comes with the vao, and we don't track it per vao
+        mElementBuffer = kUnknownName;
+    }
+}
+
+void GLStateCache::BindBuffer(const GLenum target, const GLuint buffer) {
+    GLuint* binding = this->FindBufferBinding(target);
+    if (!binding || !this->Filter(*binding == buffer)) {
+        glBindBuffer(target, buffer);
+        if (binding) {
+            *binding = buffer;
+        }
+    }
+}
+
+void GLStateCache::BindBufferBase(const GLenum target, const GLuint index, const GLuint buffer) {
+    if (target != GL_UNIFORM_BUFFER || index >= kMaxUniformBindings) {
+        glBindBufferBase(target, index, buffer);
+        if (GLuint* binding = this->FindBufferBinding(target)) {
+            *binding = buffer;
+        }
+    } else if (!this->Filter(mUniformBindings[index] == buffer && mUniformBuffer == buffer)) {
+        // also binds the generic target
+        glBindBufferBase(target, index, buffer);
+        mUniformBindings[index] = buffer;
+        mUniformBuffer = buffer;
+    }
+}
+
+void GLStateCache::DeleteProgram(const GLuint program) {
+    glDeleteProgram(program);
+    if (mProgram == program) {
+        // stays current (flagged for deletion) until another program is used
+        mProgram = kUnknownName;
+    }
+}
+
+void GLStateCache::DeleteTexture(const GLuint texture) {
+    glDeleteTextures(1, &texture);
+    for (GLuint& bound : mTextures) {
+        if (bound == texture) {
+            bound = 0;
+        }
+    }
+    for (GLuint& bound : mBufferTextures) {
+        if (bound == texture) {
+            bound = 0;
+        }
+    }
+}
+
+void GLStateCache::DeleteBuffer(const GLuint buffer) {
+    glDeleteBuffers(1, &buffer);
+
+    GLuint* bindings[] = { &mArrayBuffer, &mElementBuffer, &mUniformBuffer, &mPixelUnpackBuffer };
+    for (GLuint* bound : bindings) {
+        if (*bound == buffer) {
+            *bound = 0;
+        }
+    }
+    for (GLuint& bound : mUniformBindings) {
+        if (bound == buffer) {
+            bound = 0;
+        }
+    }
+}
+
+void GLStateCache::DeleteVertexArray(const GLuint vao) {
+    glDeleteVertexArrays(1, &vao);
+    if (mVertexArray == vao) {
+        mVertexArray = 0;
+        mElementBuffer = kUnknownName;
+    }
+}
+
+bool GLStateCache::Filter(const bool redundant) {
+    ++mStats.numCalls;
+    if (redundant) {
+        ++mStats.numFilteredCalls;
+    }
+    return redundant;
+}
+
+void GLStateCache::ActiveTexture(const size_t unit) {
+    if (!this->Filter(mActiveTexture == unit)) {
+        glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(unit));
+        mActiveTexture = unit;
+    }
+}
+
+GLuint* GLStateCache::FindBufferBinding(const GLenum target) {
+    switch (target) {
+        case GL_ARRAY_BUFFER:           return &mArrayBuffer;
+        case GL_ELEMENT_ARRAY_BUFFER:   return &mElementBuffer;
+        case GL_UNIFORM_BUFFER:         return &mUniformBuffer;
+        case GL_PIXEL_UNPACK_BUFFER:    return &mPixelUnpackBuffer;
+        default:                        return nullptr;
+    }
+}
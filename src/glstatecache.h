@@ -0,0 +1,79 @@
+#pragma once
+#include <glad/glad.h>
+#include <cstddef>
+
+#include "singleton.h"
+
+// Shadow copy of the GL state we touch, so redundant state calls never reach the driver.
+// Everything that changes this state has to go through the cache, otherwise the shadow copy
+// goes stale. Call Invalidate() after foreign code touched GL behind our back.
+DECLARE_SINGLETON(GLStateCache) {
+public:
+    static const size_t kMaxTextureUnits    = 48;   // GL 3.3 minimum of combined units
+    static const size_t kMaxUniformBindings = 8;
+
+    struct Stats {
+        size_t  numCalls;           // state calls requested
+        size_t  numFilteredCalls;   // ... and skipped as redundant
+    };
+
+    GLStateCache();
+    ~GLStateCache();
+
+    void            Invalidate();
+    // starts a new stats frame, call once per frame
+    void            BeginFrame();
+    const Stats&    GetLastFrameStats() const;
+
+    void            UseProgram(const GLuint program);
+    // tracks GL_BLEND, GL_CULL_FACE, GL_DEPTH_TEST and GL_SCISSOR_TEST, other caps are passed through
+    void            SetEnabled(const GLenum cap, const bool enable);
+    void            BlendFunc(const GLenum src, const GLenum dst);
+    void            BlendFuncSeparate(const GLenum srcRGB, const GLenum dstRGB, const GLenum srcAlpha, const GLenum dstAlpha);
+    void            BlendEquation(const GLenum mode);
+    void            BindTexture(const size_t unit, const GLuint texture);   // GL_TEXTURE_2D only
+    void            BindTextureBuffer(const size_t unit, const GLuint texture);
+    void            PolygonMode(const GLenum mode);                         // GL_FRONT_AND_BACK only
+    void            BindVertexArray(const GLuint vao);
+    void            BindBuffer(const GLenum target, const GLuint buffer);
+    void            BindBufferBase(const GLenum target, const GLuint index, const GLuint buffer);
+
+    // deleted names may be handed out again by GL, so bindings to them must be forgotten
+    void            DeleteProgram(const GLuint program);
+    void            DeleteTexture(const GLuint texture);
+    void            DeleteBuffer(const GLuint buffer);
+    void            DeleteVertexArray(const GLuint vao);
+
+private:
+    bool            Filter(const bool redundant);
+    void            ActiveTexture(const size_t unit);
+    GLuint*         FindBufferBinding(const GLenum target);
+
+private:
+    enum : size_t {
+        CapBlend = 0,
+        CapCullFace,
+        CapDepthTest,
+        CapScissorTest,
+
+        NumCaps
+    };
+
+    GLuint          mProgram;
+    int             mCaps[NumCaps];     // -1 unknown, 0 disabled, 1 enabled
+    GLenum          mBlendFunc[4];
+    GLenum          mBlendEquation;
+    size_t          mActiveTexture;
+    GLuint          mTextures[kMaxTextureUnits];
+    GLuint          mBufferTextures[kMaxTextureUnits];
+    GLenum          mPolygonMode;
+    GLuint          mVertexArray;
+    GLuint          mArrayBuffer;
+    GLuint          mElementBuffer;     // part of the VAO state
+    GLuint          mUniformBuffer;
+    GLuint          mPixelUnpackBuffer;
+    GLuint          mUniformBindings[kMaxUniformBindings];
+
+    Stats           mStats;
+    Stats           mLastFrameStats;
+};
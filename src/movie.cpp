@@ -307,20 +307,17 @@ bool Movie::OnProvideResource(const aeMovieResource* _resource, void** _rd, void
             MyLog << " trim_height : " << static_cast<int>(ae_image->trim_height) << MyEndl;
             MyLog << " has mesh    : " << (ae_image->mesh != nullptr ? "YES" : "NO") << MyEndl;
 
-            std::string fullPath = mBaseFolder + ae_image->path;
+            // the buffer is reused, so only its first few paths allocate
+            mResourcePath.assign(mBaseFolder);
+            mResourcePath.append(ae_image->atlas_image ? ae_image->atlas_image->path : ae_image->path);
 
-            if (ae_image->atlas_image == AE_NULL) {
-                *_rd = reinterpret_cast<ae_voidptr_t>(ResourcesManager::Instance().GetTextureRes(fullPath));
-            } else {
-                std::string texturePath = mBaseFolder + ae_image->atlas_image->path;
-
-                ResourceImage* image = ResourcesManager::Instance().GetImageRes(ae_image->name);
+            // composition expects ResourceImage for every image layer, so standalone images get one too
+            ResourceImage* image = ResourcesManager::Instance().GetImageRes(ae_image->name);
 
-                image->textureRes = ResourcesManager::Instance().GetTextureRes(texturePath);
-                image->premultAlpha = (ae_image->is_premultiplied == AE_TRUE);
+            image->textureRes = ResourcesManager::Instance().GetTextureRes(mResourcePath);
+            image->premultAlpha = (ae_image->is_premultiplied == AE_TRUE);
 
-                *_rd = reinterpret_cast<ae_voidptr_t>(image);
-            }
+            *_rd = reinterpret_cast<ae_voidptr_t>(image);
         } break;
 
         case AE_MOVIE_RESOURCE_SEQUENCE: {
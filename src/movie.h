@@ -41,6 +41,7 @@ private:
     aeMovieData*                                mMovieData;
     float                                       mVersion;
     std::string                                 mBaseFolder;
+    std::string                                 mResourcePath;  // scratch for OnProvideResource
 
     std::vector<const aeMovieCompositionData*>  mCompositions;
 };
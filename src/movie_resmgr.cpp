@@ -1,4 +1,10 @@
 #include "movie_resmgr.h"
+#include "glstatecache.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_NO_HDR
@@ -9,34 +15,74 @@
 
 
 
-static size_t FNV1A_Hash(const std::string& str) {
-    size_t result = 0;
-    const char* traitName = str.c_str();
-    const size_t len = str.length();
-    size_t mult = 1u, c = 816753u;
-    for (size_t i = 0; i < len; ++i) {
-        result += static_cast<size_t>(traitName[i]) * mult;
-        mult += c;
-        c += (c + 13u) >> 1u;
+// beyond that the hint is more likely wrong than the texture that big
+static const uint32_t kMaxSkipLevels = 4;
+
+// every halving that still leaves at least a texel per pixel at that scale
+static uint32_t CalcSkipLevels(const float contentScale) {
+    uint32_t skipLevels = 0;
+    float scale = contentScale;
+    while (scale > 0.0f && scale * 2.0f <= 1.0f && skipLevels < kMaxSkipLevels) {
+        scale *= 2.0f;
+        ++skipLevels;
+    }
+    return skipLevels;
+}
+
+static uint32_t CalcNumLevels(const uint32_t width, const uint32_t height) {
+    uint32_t numLevels = 1;
+    for (uint32_t size = std::max(width, height); size > 1; size >>= 1) {
+        ++numLevels;
+    }
+    return numLevels;
+}
+
+// 2x2 box filter to the next level, sizes are floored like GL does, so an odd last row
+// or column is dropped, a side of 1 is averaged with itself
+// plain loops over bytes, the compiler vectorizes those well enough
+static void DownsampleBox(const uint8_t* src, const uint32_t width, const uint32_t height, const uint32_t comp, uint8_t* dst) {
+    const uint32_t dstWidth = std::max<uint32_t>(width >> 1, 1);
+    const uint32_t dstHeight = std::max<uint32_t>(height >> 1, 1);
+    const size_t pitch = static_cast<size_t>(width) * comp;
+    const size_t dx = width > 1 ? comp : 0;
+    const size_t dy = height > 1 ? pitch : 0;
+
+    for (uint32_t y = 0; y < dstHeight; ++y) {
+        const uint8_t* row0 = src + static_cast<size_t>(y) * 2 * dy;
+        const uint8_t* row1 = row0 + dy;
+        uint8_t* out = dst + static_cast<size_t>(y) * dstWidth * comp;
+        for (uint32_t x = 0; x < dstWidth; ++x) {
+            const size_t i = static_cast<size_t>(x) * 2 * dx;
+            for (uint32_t c = 0; c < comp; ++c) {
+                const uint32_t sum = row0[i + c] + row0[i + dx + c] + row1[i + c] + row1[i + dx + c];
+                out[x * comp + c] = static_cast<uint8_t>((sum + 2) >> 2);
+            }
+        }
     }
-    return result;
 }
 
 
 
 ResourcesManager::ResourcesManager()
     : mWhiteTexture(0)
+    , mNumPendingTextures(0)
+    , mDecodeQuit(false)
+    , mDecodeStats()
+    , mUploadBudget(kDefaultUploadBudget)
+    , mTextureScale(1.0f)
+    , mSkipLevels(0)
+    , mTextureMipmaps(false)
 {
 }
 ResourcesManager::~ResourcesManager() {
 }
 
-void ResourcesManager::Initialize() {
+void ResourcesManager::Initialize(const size_t numDecodeThreads) {
     if (!mWhiteTexture) {
         uint32_t whitePixel = 0xFFFFFFFF;
 
         glGenTextures(1, &mWhiteTexture);
-        glBindTexture(GL_TEXTURE_2D, mWhiteTexture);
+        GLStateCache::Instance().BindTexture(0, mWhiteTexture);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &whitePixel);
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -44,106 +90,437 @@ void ResourcesManager::Initialize() {
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-        glBindTexture(GL_TEXTURE_2D, 0);
+        GLStateCache::Instance().BindTexture(0, 0);
+
+        mUploadQueue.Create(mUploadBudget);
+    }
+
+    if (mDecodeWorkers.empty()) {
+        size_t numThreads = numDecodeThreads;
+        if (!numThreads) {
+            // the GL thread keeps drawing meanwhile, so it doesn't count
+            const size_t hwThreads = static_cast<size_t>(std::thread::hardware_concurrency());
+            numThreads = std::max<size_t>(hwThreads, 2) - 1;
+        }
+
+        mDecodeQuit = false;
+        mNumPendingTextures = 0;
+        mDecodeStats = DecodeStats();
+        for (size_t i = 0; i < numThreads; ++i) {
+            mDecodeWorkers.emplace_back(&ResourcesManager::DecodeWorkerLoop, this);
+        }
     }
 }
 
 void ResourcesManager::Shutdown() {
-    if (mWhiteTexture) {
-        glDeleteTextures(1, &mWhiteTexture);
-        mWhiteTexture = 0;
+    // queued textures are dropped, the ones being decoded are thrown away by their workers
+    {
+        std::lock_guard<std::mutex> lock(mDecodeMutex);
+        mDecodeQuit = true;
+        mDecodeQueue.clear();
+    }
+    mDecodeCondition.notify_all();
+
+    for (std::thread& worker : mDecodeWorkers) {
+        worker.join();
+    }
+    mDecodeWorkers.clear();
+
+    for (DecodeJob& job : mDecodedJobs) {
+        FreeJobPixels(job);
     }
+    mDecodedJobs.clear();
 
-    for (auto& p : mResources) {
-        Resource* res = p.second;
+    // half uploaded textures never made it to their resource
+    for (const TextureUploadQueue::Upload& upload : mUploadQueue.GetQueued()) {
+        GLStateCache::Instance().DeleteTexture(upload.texture);
+        this->ReleasePixels(upload.pixels);
+    }
+    mUploadQueue.Destroy();
+    mNumPendingTextures = 0;
+
+    mResources.ForEach([](Resource* res) {
         if (res->type == Resource::Texture) {
             ResourceTexture* tex = static_cast<ResourceTexture*>(res);
-            glDeleteTextures(1, &tex->texture);
+            if (tex->uploaded) {
+                GLStateCache::Instance().DeleteTexture(tex->texture);
+            }
         }
 
         delete res;
-    }
+    });
+
+    mResources.Clear();
 
-    mResources.clear();
+    if (mWhiteTexture) {
+        GLStateCache::Instance().DeleteTexture(mWhiteTexture);
+        mWhiteTexture = 0;
+    }
 }
 
 GLuint ResourcesManager::GetWhiteTexture() const {
     return mWhiteTexture;
 }
 
-ResourceTexture* ResourcesManager::GetTextureRes(const std::string& fileName) {
-    const size_t hash = FNV1A_Hash(fileName);
-    ResourcesTable::iterator it = mResources.find(hash);
-    if (it != mResources.end() && it->second->type == Resource::Texture) {
-        return static_cast<ResourceTexture*>(it->second);
+ResourceTexture* ResourcesManager::GetTextureRes(const std::string_view& fileName) {
+    Resource* res = mResources.Find(Resource::Texture, fileName);
+    if (res) {
+        return static_cast<ResourceTexture*>(res);
     } else {
         return this->LoadTextureRes(fileName);
     }
 }
 
-ResourceImage* ResourcesManager::GetImageRes(const std::string& imageName) {
-    const size_t hash = FNV1A_Hash(imageName);
-    ResourcesTable::iterator it = mResources.find(hash);
-    if (it != mResources.end() && it->second->type == Resource::Image) {
-        return static_cast<ResourceImage*>(it->second);
+ResourceImage* ResourcesManager::GetImageRes(const std::string_view& imageName) {
+    Resource* res = mResources.Find(Resource::Image, imageName);
+    if (res) {
+        return static_cast<ResourceImage*>(res);
     } else {
         ResourceImage* image = new ResourceImage();
-        mResources.insert({hash, image});
+        mResources.Insert(Resource::Image, imageName, image);
         return image;
     }
 }
 
-ResourceTexture* ResourcesManager::LoadTextureRes(const std::string& fileName) {
-    int width, height, comp;
-    uint8_t* data = stbi_load(fileName.c_str(), &width, &height, &comp, STBI_default);
-
-    ResourceTexture* texture = nullptr;
-    if (data) {
-        texture = new ResourceTexture();
-        texture->width = static_cast<size_t>(width);
-        texture->height = static_cast<size_t>(height);
-
-        GLint internalFmt;
-        GLenum format;
-        switch (comp) {
-            case 1: {
-                texture->format = ResourceTexture::R8;
-                internalFmt = GL_R8;
-                format = GL_RED;
-            } break;
-            case 2: {
-                texture->format = ResourceTexture::R8G8;
-                internalFmt = GL_RG8;
-                format = GL_RG;
-            } break;
-            case 3: {
-                texture->format = ResourceTexture::R8G8B8;
-                internalFmt = GL_RGB8;
-                format = GL_RGB;
-            } break;
-            case 4: {
-                texture->format = ResourceTexture::R8G8B8A8;
-                internalFmt = GL_RGBA8;
-                format = GL_RGBA;
-            } break;
+void ResourcesManager::UpdatePendingTextures() {
+    std::vector<DecodeJob> decoded;
+    {
+        std::lock_guard<std::mutex> lock(mDecodeMutex);
+        decoded.swap(mDecodedJobs);
+    }
+
+    size_t numFailed = 0, numDropped = 0;
+    for (DecodeJob& job : decoded) {
+        if (job.requestIdx != job.texture->requestIdx) {
+            // requested again for other levels meanwhile
+            FreeJobPixels(job);
+            ++numDropped;
+        } else if (job.pixels) {
+            MyLog << "Texture \"" << job.fileName << "\" (" << job.width << "x" << job.height << ", " << job.numLevels << " levels) "
+                  << (job.cached.GetData() ? "mapped from cache" : "decoded") << " in " << job.decodeMs << " ms" << MyEndl;
+            this->QueueUpload(job);
+        } else {
+            // stays white, or whatever it had before
+            ++numFailed;
+            MyLog << "Failed to decode texture \"" << job.fileName << "\"" << MyEndl;
         }
+    }
+
+    // runs even with nothing queued, that's what zeroes the last uploaded bytes
+    mUploadQueue.SetFrameBudget(mUploadBudget);
+    const std::vector<TextureUploadQueue::Upload>& uploaded = mUploadQueue.Update();
+    for (const TextureUploadQueue::Upload& upload : uploaded) {
+        ResourceTexture* texture = reinterpret_cast<ResourceTexture*>(upload.userData);
+        if (texture->uploaded) {
+            // uploads complete in order, so this one is newer, the old one isn't in any draw list yet this frame
+            GLStateCache::Instance().DeleteTexture(texture->texture);
+        }
+        texture->texture = upload.texture;
+        texture->uploaded = true;
+        this->ReleasePixels(upload.pixels);
+    }
+    const size_t numUploaded = uploaded.size();
+
+    if (!numUploaded && !numFailed && !numDropped) {
+        return;
+    }
+
+    DecodeStats stats;
+    size_t numPending;
+    {
+        std::lock_guard<std::mutex> lock(mDecodeMutex);
+        mNumPendingTextures -= numUploaded + numFailed + numDropped;
+        mDecodeStats.numUploaded += numUploaded;
+        mDecodeStats.numFailed += numFailed;
+        stats = mDecodeStats;
+        numPending = mNumPendingTextures;
+    }
+
+    if (!numPending) {
+        MyLog << "Decoded " << stats.numUploaded << " textures in " << stats.wallMs << " ms on " << mDecodeWorkers.size() << " threads ("
+              << stats.decodeMs << " ms of decoding, slowest " << stats.maxDecodeMs << " ms, " << stats.numCacheHits << " from cache)" << MyEndl;
+    }
+}
+
+size_t ResourcesManager::GetNumPendingTextures() const {
+    std::lock_guard<std::mutex> lock(mDecodeMutex);
+    return mNumPendingTextures;
+}
+
+ResourcesManager::DecodeStats ResourcesManager::GetDecodeStats() const {
+    std::lock_guard<std::mutex> lock(mDecodeMutex);
+    return mDecodeStats;
+}
+
+void ResourcesManager::SetUploadBudget(const size_t bytes) {
+    mUploadBudget = bytes;
+}
+
+size_t ResourcesManager::GetUploadBudget() const {
+    return mUploadBudget;
+}
 
-        glGenTextures(1, &texture->texture);
-        glBindTexture(GL_TEXTURE_2D, texture->texture);
-        glTexImage2D(GL_TEXTURE_2D, 0, internalFmt, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+size_t ResourcesManager::GetLastUploadedBytes() const {
+    return mUploadQueue.GetLastUploadedBytes();
+}
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+void ResourcesManager::SetTextureScaleHint(const float contentScale) {
+    mTextureScale = contentScale;
 
-        glBindTexture(GL_TEXTURE_2D, 0);
+    const uint32_t skipLevels = CalcSkipLevels(contentScale);
+    if (skipLevels != mSkipLevels) {
+        mSkipLevels = skipLevels;
+        this->UpdateTextureLevels();
+    }
+}
 
-        stbi_image_free(data);
+float ResourcesManager::GetTextureScaleHint() const {
+    return mTextureScale;
+}
 
-        const size_t hash = FNV1A_Hash(fileName);
-        mResources.insert({hash, texture});
+void ResourcesManager::SetTextureMipmaps(const bool enable) {
+    if (enable != mTextureMipmaps) {
+        mTextureMipmaps = enable;
+        this->UpdateTextureLevels();
     }
+}
+
+bool ResourcesManager::IsTextureMipmaps() const {
+    return mTextureMipmaps;
+}
+
+void ResourcesManager::SetTextureCacheDir(const std::string& dir) {
+    mDiskCache.SetDirectory(dir);
+}
+
+ResourceTexture* ResourcesManager::LoadTextureRes(const std::string_view& fileName) {
+    ResourceTexture* texture = new ResourceTexture();
+    texture->texture = mWhiteTexture;
+    texture->fileName = fileName;
+
+    mResources.Insert(Resource::Texture, fileName, texture);
+
+    this->RequestDecode(texture);
 
     return texture;
 }
+
+void ResourcesManager::RequestDecode(ResourceTexture* texture) {
+    texture->skipLevels = mSkipLevels;
+    texture->mipmaps = mTextureMipmaps;
+    ++texture->requestIdx;
+
+    DecodeJob job;
+    job.texture = texture;
+    job.fileName = texture->fileName;
+    job.requestIdx = texture->requestIdx;
+    job.skipLevels = texture->skipLevels;
+    job.mipmaps = texture->mipmaps;
+    job.pixels = nullptr;
+    job.width = job.height = job.comp = 0;
+    job.numLevels = 0;
+    job.decodeMs = 0.0;
+    {
+        std::lock_guard<std::mutex> lock(mDecodeMutex);
+        if (!mDecodeStats.numRequested) {
+            mDecodeStartTime = Clock::now();
+        }
+        ++mDecodeStats.numRequested;
+        ++mNumPendingTextures;
+        mDecodeQueue.push_back(std::move(job));
+    }
+    mDecodeCondition.notify_one();
+}
+
+void ResourcesManager::UpdateTextureLevels() {
+    {
+        // not started yet, so they can simply be decoded for the new levels
+        std::lock_guard<std::mutex> lock(mDecodeMutex);
+        for (DecodeJob& job : mDecodeQueue) {
+            if (job.requestIdx == job.texture->requestIdx) {
+                job.skipLevels = job.texture->skipLevels = mSkipLevels;
+                job.mipmaps = job.texture->mipmaps = mTextureMipmaps;
+            }
+        }
+    }
+
+    mResources.ForEach([this](Resource* res) {
+        if (res->type == Resource::Texture) {
+            ResourceTexture* tex = static_cast<ResourceTexture*>(res);
+            if (tex->skipLevels != mSkipLevels || tex->mipmaps != mTextureMipmaps) {
+                this->RequestDecode(tex);
+            }
+        }
+    });
+}
+
+void ResourcesManager::DecodeWorkerLoop() {
+    for (;;) {
+        DecodeJob job;
+        {
+            std::unique_lock<std::mutex> lock(mDecodeMutex);
+            mDecodeCondition.wait(lock, [this]() { return mDecodeQuit || !mDecodeQueue.empty(); });
+            if (mDecodeQuit) {
+                return;
+            }
+            job = std::move(mDecodeQueue.front());
+            mDecodeQueue.pop_front();
+        }
+
+        const Clock::time_point start = Clock::now();
+        TextureDiskCache::Texture cached;
+        const bool hit = mDiskCache.Load(job.fileName, job.skipLevels, job.mipmaps, cached, job.cached);
+        if (hit) {
+            job.pixels = cached.pixels;
+            job.width = static_cast<int>(cached.width);
+            job.height = static_cast<int>(cached.height);
+            job.comp = static_cast<int>(cached.comp);
+            job.numLevels = cached.numLevels;
+        } else {
+            job.pixels = stbi_load(job.fileName.c_str(), &job.width, &job.height, &job.comp, STBI_default);
+            if (job.pixels) {
+                BuildTextureLevels(job);
+            }
+        }
+        const Clock::time_point end = Clock::now();
+        job.decodeMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+        // out of the timings, the textures are usable without it
+        if (!hit && job.pixels) {
+            cached.pixels = job.pixels;
+            cached.width = static_cast<uint32_t>(job.width);
+            cached.height = static_cast<uint32_t>(job.height);
+            cached.comp = static_cast<uint32_t>(job.comp);
+            cached.numLevels = job.numLevels;
+            mDiskCache.Store(job.fileName, job.skipLevels, job.mipmaps, cached);
+        }
+
+        std::lock_guard<std::mutex> lock(mDecodeMutex);
+        if (mDecodeQuit) {
+            // the texture may be gone already
+            FreeJobPixels(job);
+            return;
+        }
+        mDecodeStats.numCacheHits += hit ? 1 : 0;
+        mDecodeStats.decodeMs += job.decodeMs;
+        mDecodeStats.maxDecodeMs = std::max(mDecodeStats.maxDecodeMs, job.decodeMs);
+        mDecodeStats.wallMs = std::chrono::duration<double, std::milli>(end - mDecodeStartTime).count();
+        mDecodedJobs.push_back(std::move(job));
+    }
+}
+
+void ResourcesManager::BuildTextureLevels(DecodeJob& job) {
+    const uint32_t comp = static_cast<uint32_t>(job.comp);
+    uint32_t width = static_cast<uint32_t>(job.width);
+    uint32_t height = static_cast<uint32_t>(job.height);
+
+    // the skipped levels go through scratch buffers, the kept ones are built right in the final one
+    std::vector<uint8_t> base, halved;
+    const uint8_t* src = job.pixels;
+    for (uint32_t i = 0; i < job.skipLevels && (width > 1 || height > 1); ++i) {
+        halved.resize(TextureUploadQueue::CalcLevelsSize(width >> 1, height >> 1, 1, comp));
+        DownsampleBox(src, width, height, comp, halved.data());
+        width = std::max<uint32_t>(width >> 1, 1);
+        height = std::max<uint32_t>(height >> 1, 1);
+        base.swap(halved);
+        src = base.data();
+    }
+
+    job.numLevels = job.mipmaps ? CalcNumLevels(width, height) : 1;
+    if (src == job.pixels && job.numLevels == 1) {
+        return;
+    }
+
+    uint8_t* levels = reinterpret_cast<uint8_t*>(malloc(TextureUploadQueue::CalcLevelsSize(width, height, job.numLevels, comp)));
+    if (!levels) {
+        // the full size one still does
+        job.numLevels = 1;
+        return;
+    }
+
+    memcpy(levels, src, static_cast<size_t>(width) * height * comp);
+    uint8_t* level = levels;
+    for (uint32_t i = 1; i < job.numLevels; ++i) {
+        const uint32_t levelWidth = TextureUploadQueue::CalcLevelSize(width, i - 1);
+        const uint32_t levelHeight = TextureUploadQueue::CalcLevelSize(height, i - 1);
+        uint8_t* next = level + static_cast<size_t>(levelWidth) * levelHeight * comp;
+        DownsampleBox(level, levelWidth, levelHeight, comp, next);
+        level = next;
+    }
+
+    stbi_image_free(const_cast<uint8_t*>(job.pixels));
+    job.pixels = levels;
+    job.width = static_cast<int>(width);
+    job.height = static_cast<int>(height);
+}
+
+void ResourcesManager::QueueUpload(DecodeJob& job) {
+    ResourceTexture* texture = job.texture;
+    texture->width = static_cast<size_t>(job.width);
+    texture->height = static_cast<size_t>(job.height);
+
+    TextureUploadQueue::Upload upload;
+    switch (job.comp) {
+        case 1: {
+            texture->format = ResourceTexture::R8;
+            upload.internalFormat = GL_R8;
+            upload.format = GL_RED;
+        } break;
+        case 2: {
+            texture->format = ResourceTexture::R8G8;
+            upload.internalFormat = GL_RG8;
+            upload.format = GL_RG;
+        } break;
+        case 3: {
+            texture->format = ResourceTexture::R8G8B8;
+            upload.internalFormat = GL_RGB8;
+            upload.format = GL_RGB;
+        } break;
+        default: {
+            texture->format = ResourceTexture::R8G8B8A8;
+            upload.internalFormat = GL_RGBA8;
+            upload.format = GL_RGBA;
+        } break;
+    }
+
+    glGenTextures(1, &upload.texture);
+    GLStateCache::Instance().BindTexture(0, upload.texture);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, job.numLevels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+    GLStateCache::Instance().BindTexture(0, 0);
+
+    // the queue owns the pixels now, UpdatePendingTextures releases them once they're uploaded
+    if (job.cached.GetData()) {
+        mMappedPixels.emplace(job.pixels, std::move(job.cached));
+    }
+    upload.pixels = job.pixels;
+    upload.width = static_cast<uint32_t>(job.width);
+    upload.height = static_cast<uint32_t>(job.height);
+    upload.numLevels = job.numLevels;
+    upload.bytesPerPixel = static_cast<uint32_t>(job.comp);
+    upload.userData = texture;
+    mUploadQueue.Push(upload);
+}
+
+void ResourcesManager::ReleasePixels(const uint8_t* pixels) {
+    MappedPixelsTable::iterator it = mMappedPixels.find(pixels);
+    if (it != mMappedPixels.end()) {
+        // unmaps it
+        mMappedPixels.erase(it);
+    } else {
+        stbi_image_free(const_cast<uint8_t*>(pixels));
+    }
+}
+
+void ResourcesManager::FreeJobPixels(DecodeJob& job) {
+    if (job.cached.GetData()) {
+        job.cached.Close();
+    } else {
+        stbi_image_free(const_cast<uint8_t*>(job.pixels));
+    }
+    job.pixels = nullptr;
+}
@@ -1,9 +1,20 @@
 #pragma once
 #include <glad/glad.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
+#include "resourceindex.h"
 #include "singleton.h"
+#include "texturecache.h"
+#include "textureupload.h"
 
 
 struct Resource {
@@ -31,12 +42,29 @@ struct ResourceTexture : public Resource {
         R8G8B8A8
     };
 
-    size_t  width;
-    size_t  height;
-    size_t  format;
-    GLuint  texture;
-
-    ResourceTexture() {
+    // size (of the uploaded level 0) & format are only known once the texture is decoded
+    size_t      width;
+    size_t      height;
+    size_t      format;
+    GLuint      texture;    // the white texture until the decoded pixels are uploaded
+    bool        uploaded;   // texture is its own
+
+    // what the latest decode was asked for, see ResourcesManager::SetTextureScaleHint
+    std::string fileName;
+    uint32_t    skipLevels;
+    bool        mipmaps;
+    uint32_t    requestIdx; // older decodes are dropped when they complete
+
+    ResourceTexture()
+        : width(0)
+        , height(0)
+        , format(R8G8B8A8)
+        , texture(0)
+        , uploaded(false)
+        , skipLevels(0)
+        , mipmaps(false)
+        , requestIdx(0)
+    {
         type = Resource::Texture;
     }
 };
@@ -53,25 +81,121 @@ struct ResourceImage : public Resource {
     }
 };
 
+// Textures are decoded on a few worker threads, GetTextureRes hands out the resource right away
+// and it samples as white until UpdatePendingTextures uploads its pixels on the GL thread.
+// Uploads go through a TextureUploadQueue, so they are spread over frames by the upload budget.
+// With a texture cache directory the decoded levels are also kept on disk, so the next load of an
+// unchanged image maps them and uploads right from the mapping, skipping stbi altogether.
+// A content scale hint lets the workers halve big images right after decoding, so compositions
+// shown scaled down don't keep (and sample) texels that never reach the screen.
 DECLARE_SINGLETON(ResourcesManager) {
 public:
+    static const size_t kDefaultUploadBudget = 4 * 1024 * 1024;
+
+    // textures requested since Initialize
+    struct DecodeStats {
+        size_t  numRequested;
+        size_t  numUploaded;
+        size_t  numFailed;
+        size_t  numCacheHits;   // mapped from the texture cache instead of decoded
+        double  decodeMs;       // summed over the textures, what decoding them one by one would take
+        double  maxDecodeMs;    // slowest texture
+        double  wallMs;         // from the first request till the last decode finished
+    };
+
     ResourcesManager();
     ~ResourcesManager();
 
-    void                Initialize();
+    // numDecodeThreads 0 means one per hardware thread, but the GL one
+    void                Initialize(const size_t numDecodeThreads = 0);
     void                Shutdown();
 
     GLuint              GetWhiteTexture() const;
 
-    ResourceTexture*    GetTextureRes(const std::string& fileName);
-    ResourceImage*      GetImageRes(const std::string& imageName);
+    ResourceTexture*    GetTextureRes(const std::string_view& fileName);
+    ResourceImage*      GetImageRes(const std::string_view& imageName);
+
+    // queues whatever the workers have decoded so far and uploads up to the budget of it,
+    // GL thread only, call once a frame, between submitting one frame's draw lists and building the next
+    // as it swaps the texture handles of the resources
+    void                UpdatePendingTextures();
+    size_t              GetNumPendingTextures() const;
+    DecodeStats         GetDecodeStats() const;
+
+    // pixel bytes UpdatePendingTextures may upload per call
+    void                SetUploadBudget(const size_t bytes);
+    size_t              GetUploadBudget() const;
+    // uploaded by the last UpdatePendingTextures
+    size_t              GetLastUploadedBytes() const;
+
+    // textures are halved while they'd still cover at least their size on screen at `contentScale`,
+    // layer transforms aren't known here, so this is for the composition as a whole
+    // textures decoded for another level are decoded again, the old one is kept till then
+    void                SetTextureScaleHint(const float contentScale);
+    float               GetTextureScaleHint() const;
+    // with mipmaps every texture gets its full chain, box filtered on the decode workers
+    void                SetTextureMipmaps(const bool enable);
+    bool                IsTextureMipmaps() const;
+
+    // decoded textures are kept there & mapped back on the next load, empty (the default) disables it
+    // the workers read it, so set it before Initialize
+    void                SetTextureCacheDir(const std::string& dir);
 
 private:
-    ResourceTexture*    LoadTextureRes(const std::string& fileName);
+    struct DecodeJob {
+        ResourceTexture*    texture;
+        std::string         fileName;
+        uint32_t            requestIdx;
+        uint32_t            skipLevels;
+        bool                mipmaps;
+        // all levels back to back, from stbi or malloc (stbi_image_free frees both) or in `cached`,
+        // null if decoding failed
+        const uint8_t*      pixels;
+        MappedFile          cached;
+        int                 width;      // of level 0
+        int                 height;
+        int                 comp;
+        uint32_t            numLevels;
+        double              decodeMs;
+    };
 
-private:
-    typedef std::unordered_map<size_t, Resource*> ResourcesTable;
+    ResourceTexture*    LoadTextureRes(const std::string_view& fileName);
+    void                RequestDecode(ResourceTexture* texture);
+    // queued decodes pick up the current levels, the other textures that don't match are requested again
+    void                UpdateTextureLevels();
+    void                DecodeWorkerLoop();
+    void                QueueUpload(DecodeJob& job);
+    // pixels of a completed or dropped upload
+    void                ReleasePixels(const uint8_t* pixels);
+    static void         FreeJobPixels(DecodeJob& job);
+    static void         BuildTextureLevels(DecodeJob& job);
 
-    GLuint          mWhiteTexture;
-    ResourcesTable  mResources;
+private:
+    typedef std::unordered_map<const uint8_t*, MappedFile> MappedPixelsTable;
+    typedef std::chrono::steady_clock Clock;
+
+    GLuint                      mWhiteTexture;
+    ResourceIndex               mResources;
+
+    // decoding, the queues & stats are protected by mDecodeMutex, the resources are only written on the GL thread,
+    // by UpdatePendingTextures, readers (Composition::BuildCommandList) must not run meanwhile
+    std::vector<std::thread>    mDecodeWorkers;
+    mutable std::mutex          mDecodeMutex;
+    std::condition_variable     mDecodeCondition;
+    std::deque<DecodeJob>       mDecodeQueue;
+    std::vector<DecodeJob>      mDecodedJobs;
+    size_t                      mNumPendingTextures;   // requested, not uploaded yet
+    bool                        mDecodeQuit;
+    DecodeStats                 mDecodeStats;
+    Clock::time_point           mDecodeStartTime;
+
+    TextureUploadQueue          mUploadQueue;   // user data is the ResourceTexture, pixels are the job's
+    size_t                      mUploadBudget;
+    TextureDiskCache            mDiskCache;
+    MappedPixelsTable           mMappedPixels;  // cache entries being uploaded straight from, by their pixels
+
+    // levels new decodes are requested with
+    float                       mTextureScale;
+    uint32_t                    mSkipLevels;
+    bool                        mTextureMipmaps;
 };
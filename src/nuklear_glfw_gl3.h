@@ -44,6 +44,7 @@ NK_API void                 nk_glfw3_mouse_button_callback(GLFWwindow *win, int
  * ===============================================================
  */
 #ifdef NK_GLFW_GL3_IMPLEMENTATION
+#include "glstatecache.h"
 
 #ifndef NK_GLFW_TEXT_MAX
 #define NK_GLFW_TEXT_MAX 256
@@ -162,9 +163,9 @@ nk_glfw3_device_create(void)
         glGenBuffers(1, &dev->ebo);
         glGenVertexArrays(1, &dev->vao);
 
-        glBindVertexArray(dev->vao);
-        glBindBuffer(GL_ARRAY_BUFFER, dev->vbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, dev->ebo);
+        GLStateCache::Instance().BindVertexArray(dev->vao);
+        GLStateCache::Instance().BindBuffer(GL_ARRAY_BUFFER, dev->vbo);
+        GLStateCache::Instance().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, dev->ebo);
 
         glEnableVertexAttribArray((GLuint)dev->attrib_pos);
         glEnableVertexAttribArray((GLuint)dev->attrib_uv);
@@ -175,10 +176,7 @@ nk_glfw3_device_create(void)
         glVertexAttribPointer((GLuint)dev->attrib_col, 4, GL_UNSIGNED_BYTE, GL_TRUE, vs, (void*)vc);
     }
 
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    GLStateCache::Instance().BindVertexArray(0);
 }
 
 NK_INTERN void
@@ -186,7 +184,7 @@ nk_glfw3_device_upload_atlas(const void *image, int width, int height)
 {
     struct nk_glfw_device *dev = &glfw.ogl;
     glGenTextures(1, &dev->font_tex);
-    glBindTexture(GL_TEXTURE_2D, dev->font_tex);
+    GLStateCache::Instance().BindTexture(0, dev->font_tex);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, (GLsizei)width, (GLsizei)height, 0,
@@ -201,10 +199,11 @@ nk_glfw3_device_destroy(void)
     glDetachShader(dev->prog, dev->frag_shdr);
     glDeleteShader(dev->vert_shdr);
     glDeleteShader(dev->frag_shdr);
-    glDeleteProgram(dev->prog);
-    glDeleteTextures(1, &dev->font_tex);
-    glDeleteBuffers(1, &dev->vbo);
-    glDeleteBuffers(1, &dev->ebo);
+    GLStateCache::Instance().DeleteProgram(dev->prog);
+    GLStateCache::Instance().DeleteTexture(dev->font_tex);
+    GLStateCache::Instance().DeleteBuffer(dev->vbo);
+    GLStateCache::Instance().DeleteBuffer(dev->ebo);
+    GLStateCache::Instance().DeleteVertexArray(dev->vao);
     nk_buffer_free(&dev->cmds);
 }
 
@@ -222,17 +221,18 @@ nk_glfw3_render(enum nk_anti_aliasing AA, int max_vertex_buffer, int max_element
     ortho[0][0] /= (GLfloat)glfw.width;
     ortho[1][1] /= (GLfloat)glfw.height;
 
-    /* setup global state */
-    glEnable(GL_BLEND);
-    glBlendEquation(GL_FUNC_ADD);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glDisable(GL_CULL_FACE);
-    glDisable(GL_DEPTH_TEST);
-    glEnable(GL_SCISSOR_TEST);
-    glActiveTexture(GL_TEXTURE0);
+    /* setup global state, all of it goes through the state cache */
+    GLStateCache& stateCache = GLStateCache::Instance();
+    stateCache.SetEnabled(GL_BLEND, true);
+    stateCache.BlendEquation(GL_FUNC_ADD);
+    stateCache.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    stateCache.SetEnabled(GL_CULL_FACE, false);
+    stateCache.SetEnabled(GL_DEPTH_TEST, false);
+    stateCache.SetEnabled(GL_SCISSOR_TEST, true);
+    stateCache.PolygonMode(GL_FILL);
 
     /* setup program */
-    glUseProgram(dev->prog);
+    stateCache.UseProgram(dev->prog);
     glUniform1i(dev->uniform_tex, 0);
     glUniformMatrix4fv(dev->uniform_proj, 1, GL_FALSE, &ortho[0][0]);
     glViewport(0,0,(GLsizei)glfw.display_width,(GLsizei)glfw.display_height);
@@ -243,9 +243,9 @@ nk_glfw3_render(enum nk_anti_aliasing AA, int max_vertex_buffer, int max_element
         const nk_draw_index *offset = NULL;
 
         /* allocate vertex and element buffer */
-        glBindVertexArray(dev->vao);
-        glBindBuffer(GL_ARRAY_BUFFER, dev->vbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, dev->ebo);
+        stateCache.BindVertexArray(dev->vao);
+        stateCache.BindBuffer(GL_ARRAY_BUFFER, dev->vbo);
+        stateCache.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, dev->ebo);
 
         glBufferData(GL_ARRAY_BUFFER, max_vertex_buffer, NULL, GL_STREAM_DRAW);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, max_element_buffer, NULL, GL_STREAM_DRAW);
@@ -286,7 +286,7 @@ nk_glfw3_render(enum nk_anti_aliasing AA, int max_vertex_buffer, int max_element
         nk_draw_foreach(cmd, &glfw.ctx, &dev->cmds)
         {
             if (!cmd->elem_count) continue;
-            glBindTexture(GL_TEXTURE_2D, (GLuint)cmd->texture.id);
+            stateCache.BindTexture(0, (GLuint)cmd->texture.id);
             glScissor(
                 (GLint)(cmd->clip_rect.x * glfw.fb_scale.x),
                 (GLint)((glfw.height - (GLint)(cmd->clip_rect.y + cmd->clip_rect.h)) * glfw.fb_scale.y),
@@ -298,13 +298,8 @@ nk_glfw3_render(enum nk_anti_aliasing AA, int max_vertex_buffer, int max_element
         nk_clear(&glfw.ctx);
     }
 
-    /* default OpenGL state */
-    glUseProgram(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
-    glDisable(GL_BLEND);
-    glDisable(GL_SCISSOR_TEST);
+    /* default OpenGL state, bindings are left as is - the state cache keeps track of them */
+    stateCache.SetEnabled(GL_SCISSOR_TEST, false);
 }
 
 NK_API void
@@ -0,0 +1,135 @@
+#include "resourceindex.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+static const size_t kMinNumSlots    = 64;
+static const size_t kNameBlockSize  = 16 * 1024;
+
+// 8 bytes a step, paths are long and mostly share their folder
+// the finalizer spreads every bit down to the low ones the slot index is masked from
+static uint64_t HashBytes(const char* data, const size_t length, uint64_t hash) {
+    static const uint64_t kMul = 0x9E3779B97F4A7C15ull;
+
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * kMul;
+        hash ^= hash >> 29;
+    }
+    if (i < length) {
+        uint64_t word = 0;
+        memcpy(&word, data + i, length - i);
+        hash = (hash ^ word) * kMul;
+        hash ^= hash >> 29;
+    }
+
+    hash ^= length;
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+
+ResourceIndex::ResourceIndex()
+    : mSize(0)
+    , mNameBlockUsed(0)
+    , mNameBlockSize(0)
+{
+}
+ResourceIndex::~ResourceIndex() {
+}
+
+Resource* ResourceIndex::Find(const size_t type, const std::string_view& name) const {
+    if (mSlots.empty()) {
+        return nullptr;
+    }
+
+    const Slot& slot = mSlots[this->FindSlot(CalcHash(type, name), type, name)];
+    return slot.resource;
+}
+
+void ResourceIndex::Insert(const size_t type, const std::string_view& name, Resource* resource) {
+    // at most 3/4 full, linear probing gets long past that
+    if ((mSize + 1) * 4 > mSlots.size() * 3) {
+        this->Grow();
+    }
+
+    const uint64_t hash = CalcHash(type, name);
+    Slot& slot = mSlots[this->FindSlot(hash, type, name)];
+    if (!slot.resource) {
+        slot.hash = hash;
+        slot.name = this->InternName(name);
+        slot.nameLength = static_cast<uint32_t>(name.length());
+        slot.type = static_cast<uint32_t>(type);
+        ++mSize;
+    }
+    slot.resource = resource;
+}
+
+void ResourceIndex::Clear() {
+    mSlots.clear();
+    mSize = 0;
+    mNameBlocks.clear();
+    mNameBlockUsed = 0;
+    mNameBlockSize = 0;
+}
+
+size_t ResourceIndex::GetSize() const {
+    return mSize;
+}
+
+uint64_t ResourceIndex::CalcHash(const size_t type, const std::string_view& name) {
+    return HashBytes(name.data(), name.length(), 0xcbf29ce484222325ull ^ static_cast<uint64_t>(type));
+}
+
+size_t ResourceIndex::FindSlot(const uint64_t hash, const size_t type, const std::string_view& name) const {
+    const size_t mask = mSlots.size() - 1;
+    for (size_t idx = static_cast<size_t>(hash) & mask;; idx = (idx + 1) & mask) {
+        const Slot& slot = mSlots[idx];
+        if (!slot.resource) {
+            return idx;
+        }
+        if (slot.hash == hash && slot.type == type && slot.nameLength == name.length() &&
+            memcmp(slot.name, name.data(), name.length()) == 0) {
+            return idx;
+        }
+    }
+}
+
+void ResourceIndex::Grow() {
+    std::vector<Slot> slots(std::max(mSlots.size() * 2, kMinNumSlots), Slot());
+    mSlots.swap(slots);
+
+    // names are all different already, so only the empty slot has to be found
+    const size_t mask = mSlots.size() - 1;
+    for (const Slot& slot : slots) {
+        if (slot.resource) {
+            size_t idx = static_cast<size_t>(slot.hash) & mask;
+            while (mSlots[idx].resource) {
+                idx = (idx + 1) & mask;
+            }
+            mSlots[idx] = slot;
+        }
+    }
+}
+
+const char* ResourceIndex::InternName(const std::string_view& name) {
+    const size_t length = name.length();
+    if (mNameBlocks.empty() || mNameBlockUsed + length > mNameBlockSize) {
+        // the rest of the old block is left unused
+        mNameBlockSize = std::max(kNameBlockSize, length);
+        mNameBlocks.emplace_back(new char[mNameBlockSize]);
+        mNameBlockUsed = 0;
+    }
+
+    char* interned = mNameBlocks.back().get() + mNameBlockUsed;
+    memcpy(interned, name.data(), length);
+    mNameBlockUsed += length;
+    return interned;
+}
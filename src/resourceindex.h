@@ -0,0 +1,59 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+struct Resource;
+
+// Resources by type & name, in an open addressing (linear probing) table.
+// Names are interned into blocks owned by the index, so lookups take any string_view and never
+// allocate. Slots keep the full 64-bit hash next to the interned name, a probe only compares names
+// once the hashes match, so different names never alias however their hashes collide.
+// Resources are never removed one by one, so there are no tombstones, Clear drops everything.
+class ResourceIndex {
+public:
+    ResourceIndex();
+    ~ResourceIndex();
+
+    Resource*   Find(const size_t type, const std::string_view& name) const;
+    // replaces the resource if the name is in for that type already, names are limited to 4 GB
+    void        Insert(const size_t type, const std::string_view& name, Resource* resource);
+    // the resources aren't deleted, that's up to the owner
+    void        Clear();
+    size_t      GetSize() const;
+
+    template <typename Func>
+    void        ForEach(Func func) const {
+        for (const Slot& slot : mSlots) {
+            if (slot.resource) {
+                func(slot.resource);
+            }
+        }
+    }
+
+private:
+    // 32 bytes, two per cache line
+    struct Slot {
+        uint64_t    hash;
+        const char* name;       // interned, not terminated
+        uint32_t    nameLength;
+        uint32_t    type;
+        Resource*   resource;   // null for empty slots
+    };
+
+    static uint64_t CalcHash(const size_t type, const std::string_view& name);
+
+    // the one holding the name or the empty one it would go to
+    size_t      FindSlot(const uint64_t hash, const size_t type, const std::string_view& name) const;
+    void        Grow();
+    const char* InternName(const std::string_view& name);
+
+private:
+    std::vector<Slot>                       mSlots;     // power of two
+    size_t                                  mSize;
+    std::vector<std::unique_ptr<char[]>>    mNameBlocks;
+    size_t                                  mNameBlockUsed;
+    size_t                                  mNameBlockSize;
+};
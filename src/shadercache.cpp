@@ -0,0 +1,264 @@
+#include "shadercache.h"
+#include "glstatecache.h"
+#include "utils.h"
+
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+
+// bump when the file layout changes
+static const uint32_t kBinaryFileMagic   = 0x42504D4C; // 'LMPB'
+static const uint32_t kBinaryFileVersion = 1;
+
+struct BinaryFileHeader {
+    uint32_t    magic;
+    uint32_t    version;
+    uint64_t    driverHash;     // binaries are only valid for the driver that made them
+    uint32_t    format;
+    uint32_t    length;
+};
+
+
+static uint64_t FNV1A_Hash64(const void* data, const size_t length, uint64_t hash = 0xcbf29ce484222325ull) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static uint64_t FNV1A_Hash64(const char* str, uint64_t hash = 0xcbf29ce484222325ull) {
+    return str ? FNV1A_Hash64(str, strlen(str), hash) : hash;
+}
+
+static void MakeDirectory(const std::string& path) {
+#ifdef _MSC_VER
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+}
+
+static GLuint CompileShader(const char* src, const GLenum type, std::string& log) {
+    GLuint shader = glCreateShader(type);
+    if (shader) {
+        GLint status = 0;
+        glShaderSource(shader, 1, &src, 0);
+        glCompileShader(shader);
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+
+        // we grab the log anyway
+        GLint infoLen = 0;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLen);
+        if (infoLen > 1) {
+            log.resize(infoLen);
+            glGetShaderInfoLog(shader, infoLen, nullptr, const_cast<GLchar*>(log.data())); // non-const .data() in c++17
+        }
+
+        if (!status) {
+            glDeleteShader(shader);
+            shader = 0;
+        }
+    }
+    return shader;
+}
+
+static GLuint CreateProgram(const char* vs, const char* fs, const bool retrievable) {
+    std::string vsLog, fsLog;
+    GLuint vertexShader = CompileShader(vs, GL_VERTEX_SHADER, vsLog);
+    GLuint fragmentShader = CompileShader(fs, GL_FRAGMENT_SHADER, fsLog);
+
+    GLuint program = 0;
+
+    if (vertexShader && fragmentShader) {
+        program = glCreateProgram();
+        if (program) {
+            glAttachShader(program, vertexShader);
+            glAttachShader(program, fragmentShader);
+            if (retrievable) {
+                glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+            }
+            glLinkProgram(program);
+
+            // grab the log
+            GLint infoLen = 0;
+            glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLen);
+            if (infoLen > 1) {
+                std::string log; log.resize(infoLen);
+                glGetProgramInfoLog(program, infoLen, nullptr, const_cast<GLchar*>(log.data())); // non-const .data() in c++17
+
+                MyLog << "Shader link:" << MyEndl << log << MyEndl;
+            }
+
+            GLint status = 0;
+            glGetProgramiv(program, GL_LINK_STATUS, &status);
+            if (!status) {
+                glDeleteProgram(program);
+                program = 0;
+            }
+        }
+    } else {
+        if (!vsLog.empty()) {
+            MyLog <<"Vertex shader compilation:" << MyEndl << vsLog << MyEndl;
+        }
+        if (!fsLog.empty()) {
+            MyLog << "Fragment shader compilation:" << MyEndl << fsLog << MyEndl;
+        }
+    }
+
+    // we don't need our shader objects anymore, the program keeps them alive while attached
+    if (vertexShader) {
+        glDeleteShader(vertexShader);
+    }
+    if (fragmentShader) {
+        glDeleteShader(fragmentShader);
+    }
+
+    return program;
+}
+
+
+
+ShaderCache::ShaderCache()
+    : mDriverHash(0)
+    , mBinariesSupported(false)
+{
+}
+ShaderCache::~ShaderCache() {
+}
+
+void ShaderCache::Initialize(const std::string& cacheDir) {
+    mCacheDir = cacheDir;
+
+    GLint numFormats = 0;
+    if (GLAD_GL_ARB_get_program_binary) {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    }
+    mBinariesSupported = !mCacheDir.empty() && numFormats > 0;
+
+    if (mBinariesSupported) {
+        MakeDirectory(mCacheDir);
+
+        mDriverHash = FNV1A_Hash64(reinterpret_cast<const char*>(glGetString(GL_VENDOR)));
+        mDriverHash = FNV1A_Hash64(reinterpret_cast<const char*>(glGetString(GL_RENDERER)), mDriverHash);
+        mDriverHash = FNV1A_Hash64(reinterpret_cast<const char*>(glGetString(GL_VERSION)), mDriverHash);
+    }
+}
+
+void ShaderCache::Shutdown() {
+    for (auto& p : mPrograms) {
+        GLStateCache::Instance().DeleteProgram(p.second);
+    }
+
+    mPrograms.clear();
+}
+
+GLuint ShaderCache::GetProgram(const char* vs, const char* fs) {
+    // separator keeps "ab" + "c" and "a" + "bc" apart
+    const char separator = 0;
+    uint64_t hash = FNV1A_Hash64(vs);
+    hash = FNV1A_Hash64(&separator, 1, hash);
+    hash = FNV1A_Hash64(fs, hash);
+
+    ProgramsTable::iterator it = mPrograms.find(hash);
+    if (it != mPrograms.end()) {
+        return it->second;
+    }
+
+    GLuint program = this->LoadProgramBinary(hash);
+    if (!program) {
+        program = CreateProgram(vs, fs, mBinariesSupported);
+        if (program) {
+            this->SaveProgramBinary(hash, program);
+        }
+    }
+
+    // failed programs are not cached, so fixed shaders get another chance
+    if (program) {
+        mPrograms[hash] = program;
+    }
+
+    return program;
+}
+
+GLuint ShaderCache::LoadProgramBinary(const uint64_t hash) const {
+    if (!mBinariesSupported) {
+        return 0;
+    }
+
+    GLuint program = 0;
+
+    FILE* f = my_fopen(this->GetBinaryPath(hash).c_str(), "rb");
+    if (f) {
+        BinaryFileHeader header;
+        if (fread(&header, sizeof(header), 1, f) == 1 &&
+            header.magic == kBinaryFileMagic &&
+            header.version == kBinaryFileVersion &&
+            header.driverHash == mDriverHash &&
+            header.length > 0) {
+            std::vector<uint8_t> binary(header.length);
+            if (fread(binary.data(), 1, binary.size(), f) == binary.size()) {
+                program = glCreateProgram();
+                glProgramBinary(program, static_cast<GLenum>(header.format), binary.data(), static_cast<GLsizei>(header.length));
+
+                // driver is free to reject binaries, we just compile from sources then
+                GLint status = 0;
+                glGetProgramiv(program, GL_LINK_STATUS, &status);
+                if (!status) {
+                    glDeleteProgram(program);
+                    program = 0;
+                }
+            }
+        }
+
+        fclose(f);
+    }
+
+    return program;
+}
+
+void ShaderCache::SaveProgramBinary(const uint64_t hash, const GLuint program) const {
+    if (!mBinariesSupported) {
+        return;
+    }
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+
+    std::vector<uint8_t> binary(length);
+    GLenum format = 0;
+    GLsizei written = 0;
+    glGetProgramBinary(program, length, &written, &format, binary.data());
+    if (written <= 0) {
+        return;
+    }
+
+    FILE* f = my_fopen(this->GetBinaryPath(hash).c_str(), "wb");
+    if (f) {
+        BinaryFileHeader header;
+        header.magic = kBinaryFileMagic;
+        header.version = kBinaryFileVersion;
+        header.driverHash = mDriverHash;
+        header.format = static_cast<uint32_t>(format);
+        header.length = static_cast<uint32_t>(written);
+
+        fwrite(&header, sizeof(header), 1, f);
+        fwrite(binary.data(), 1, static_cast<size_t>(written), f);
+        fclose(f);
+    }
+}
+
+std::string ShaderCache::GetBinaryPath(const uint64_t hash) const {
+    char name[32] = { 0 };
+    snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(hash));
+    return mCacheDir + "/" + name;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <glad/glad.h>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "singleton.h"
+
+// Process-wide cache of linked shader programs, keyed by the hash of their sources.
+// When a cache directory is set and GL_ARB_get_program_binary is supported, linked programs
+// are also stored on disk, so the next run can skip GLSL compilation completely.
+// Programs are owned by the cache, don't delete them.
+DECLARE_SINGLETON(ShaderCache) {
+public:
+    ShaderCache();
+    ~ShaderCache();
+
+    void        Initialize(const std::string& cacheDir);
+    void        Shutdown();
+
+    GLuint      GetProgram(const char* vs, const char* fs);
+
+private:
+    GLuint      LoadProgramBinary(const uint64_t hash) const;
+    void        SaveProgramBinary(const uint64_t hash, const GLuint program) const;
+    std::string GetBinaryPath(const uint64_t hash) const;
+
+private:
+    typedef std::unordered_map<uint64_t, GLuint> ProgramsTable;
+
+    std::string     mCacheDir;
+    uint64_t        mDriverHash;
+    bool            mBinariesSupported;
+    ProgramsTable   mPrograms;
+};
@@ -68,3 +68,43 @@ static void CalcPointUV(float * _out, const float * _a, const float * _b, const
     _out[0] = u;
     _out[1] = v;
 }
+
+// CalcPointUV folded into an affine transform, so a whole mesh can be mapped with it:
+// u = _out[0] + _out[1] * x + _out[2] * y
+// v = _out[3] + _out[4] * x + _out[5] * y
+static void CalcUVAffine(float * _out, const float * _a, const float * _b, const float * _c, const float * _auv, const float * _buv, const float * _cuv) {
+    float _dAB[2];
+    __minus_v2(_dAB, _b, _a);
+
+    float _dAC[2];
+    __minus_v2(_dAC, _c, _a);
+
+    const float det = _dAB[0] * _dAC[1] - _dAB[1] * _dAC[0];
+    if (det == 0.0f) {
+        // degenerate basis, everything maps to the first uv instead of NaNs
+        _out[0] = _auv[0]; _out[1] = 0.0f; _out[2] = 0.0f;
+        _out[3] = _auv[1]; _out[4] = 0.0f; _out[5] = 0.0f;
+        return;
+    }
+
+    float inv_v = 1.f / det;
+    __mul_v2_f(_dAB, inv_v);
+    __mul_v2_f(_dAC, inv_v);
+
+    // barycentric a, b as functions of the point
+    float av[3] = {_dAC[0] * _a[1] - _dAC[1] * _a[0], _dAC[1], -_dAC[0]};
+    float bv[3] = {_dAB[1] * _a[0] - _dAB[0] * _a[1], -_dAB[1], _dAB[0]};
+
+    float _duvAB[2];
+    __minus_v2(_duvAB, _buv, _auv);
+
+    float _duvAC[2];
+    __minus_v2(_duvAC, _cuv, _auv);
+
+    for (int i = 0; i < 2; ++i) {
+        float * row = _out + i * 3;
+        row[0] = _auv[i] + _duvAB[i] * av[0] + _duvAC[i] * bv[0];
+        row[1] = _duvAB[i] * av[1] + _duvAC[i] * bv[1];
+        row[2] = _duvAB[i] * av[2] + _duvAC[i] * bv[2];
+    }
+}
@@ -0,0 +1,202 @@
+#include "streambuffer.h"
+#include "glstatecache.h"
+
+#include <algorithm>
+
+static const GLuint64 kFenceWaitTimeout = 1000000; // 1 ms in nanoseconds
+
+
+StreamBuffer::StreamBuffer()
+    : mTarget(GL_ARRAY_BUFFER)
+    , mBuffer(0)
+    , mSegmentSize(0)
+    , mSegment(0)
+    , mCursor(0)
+    , mPersistent(false)
+    , mPersistentData(nullptr)
+    , mMappedData(nullptr)
+{
+    for (GLsync& fence : mFences) {
+        fence = nullptr;
+    }
+}
+
+StreamBuffer::~StreamBuffer() {
+    this->Destroy();
+}
+
+bool StreamBuffer::Create(const GLenum target, const size_t segmentSize) {
+    this->Destroy();
+
+    const GLsizeiptr totalSize = static_cast<GLsizeiptr>(segmentSize * kNumSegments);
+
+    mTarget = target;
+    mSegmentSize = segmentSize;
+    mSegment = 0;
+    mCursor = 0;
+
+    glGenBuffers(1, &mBuffer);
+    GLStateCache::Instance().BindBuffer(mTarget, mBuffer);
+
+    if (GLAD_GL_ARB_buffer_storage) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(mTarget, totalSize, nullptr, flags);
+        mPersistentData = reinterpret_cast<uint8_t*>(glMapBufferRange(mTarget, 0, totalSize, flags));
+        mPersistent = (mPersistentData != nullptr);
+
+        if (!mPersistent) {
+            // storage is immutable now, so we need a fresh buffer for the fallback path
+            GLStateCache::Instance().DeleteBuffer(mBuffer);
+            glGenBuffers(1, &mBuffer);
+            GLStateCache::Instance().BindBuffer(mTarget, mBuffer);
+        }
+    }
+
+    if (!mPersistent) {
+        glBufferData(mTarget, totalSize, nullptr, GL_STREAM_DRAW);
+    }
+
+    GLStateCache::Instance().BindBuffer(mTarget, 0);
+
+    return mBuffer != 0;
+}
+
+void StreamBuffer::Destroy() {
+    for (GLsync& fence : mFences) {
+        if (fence) {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+
+    if (mBuffer) {
+        if (mPersistent || mMappedData) {
+            GLStateCache::Instance().BindBuffer(mTarget, mBuffer);
+            glUnmapBuffer(mTarget);
+            GLStateCache::Instance().BindBuffer(mTarget, 0);
+        }
+
+        GLStateCache::Instance().DeleteBuffer(mBuffer);
+        mBuffer = 0;
+    }
+
+    mPersistent = false;
+    mPersistentData = nullptr;
+    mMappedData = nullptr;
+}
+
+bool StreamBuffer::Reserve(const size_t minSegmentSize) {
+    if (!mBuffer || minSegmentSize <= mSegmentSize) {
+        return false;
+    }
+
+    // at least double, so a slowly growing composition doesn't recreate the buffer every frame
+    // the old storage may still be in use by the GPU, GL keeps it alive until it's done
+    const size_t segmentSize = std::max(minSegmentSize, mSegmentSize * 2);
+    this->Create(mTarget, segmentSize);
+    return true;
+}
+
+void* StreamBuffer::Map(const size_t minSize, const size_t alignment) {
+    if (!mBuffer || minSize > mSegmentSize) {
+        return nullptr;
+    }
+
+    size_t offset = ((mCursor + alignment - 1) / alignment) * alignment;
+    const size_t segmentEnd = (mSegment + 1) * mSegmentSize;
+    if (offset + minSize > segmentEnd) {
+        this->NextSegment();
+        offset = mCursor;
+    }
+
+    mCursor = offset;
+
+    if (mPersistent) {
+        mMappedData = mPersistentData + mCursor;
+    } else {
+        // the segment is either fresh after orphaning or not yet used by the GPU, no need to sync
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_FLUSH_EXPLICIT_BIT;
+        const size_t currentSegmentEnd = (mSegment + 1) * mSegmentSize;
+
+        GLStateCache::Instance().BindBuffer(mTarget, mBuffer);
+        mMappedData = reinterpret_cast<uint8_t*>(glMapBufferRange(mTarget,
+                                                                  static_cast<GLintptr>(mCursor),
+                                                                  static_cast<GLsizeiptr>(currentSegmentEnd - mCursor),
+                                                                  flags));
+    }
+
+    return mMappedData;
+}
+
+size_t StreamBuffer::Commit(const size_t size) {
+    const size_t offset = mCursor;
+
+    if (!mPersistent && mMappedData) {
+        GLStateCache::Instance().BindBuffer(mTarget, mBuffer);
+        if (size) {
+            glFlushMappedBufferRange(mTarget, 0, static_cast<GLsizeiptr>(size));
+        }
+        glUnmapBuffer(mTarget);
+    }
+
+    mMappedData = nullptr;
+    mCursor += size;
+
+    return offset;
+}
+
+void StreamBuffer::EndFrame() {
+    if (mMappedData) {
+        this->Commit(0);
+    }
+
+    this->NextSegment();
+}
+
+GLuint StreamBuffer::GetBuffer() const {
+    return mBuffer;
+}
+
+size_t StreamBuffer::GetSegmentSize() const {
+    return mSegmentSize;
+}
+
+bool StreamBuffer::IsPersistent() const {
+    return mPersistent;
+}
+
+bool StreamBuffer::IsMapped() const {
+    return mMappedData != nullptr;
+}
+
+void StreamBuffer::NextSegment() {
+    if (mPersistent) {
+        mFences[mSegment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    mSegment = (mSegment + 1) % kNumSegments;
+    mCursor = mSegment * mSegmentSize;
+
+    if (mPersistent) {
+        this->WaitSegment(mSegment);
+    } else if (mSegment == 0) {
+        // wrapped around - orphan the storage so the driver hands us a fresh one
+        GLStateCache::Instance().BindBuffer(mTarget, mBuffer);
+        glBufferData(mTarget, static_cast<GLsizeiptr>(mSegmentSize * kNumSegments), nullptr, GL_STREAM_DRAW);
+    }
+}
+
+void StreamBuffer::WaitSegment(const size_t segment) {
+    GLsync& fence = mFences[segment];
+    if (fence) {
+        for (;;) {
+            const GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, kFenceWaitTimeout);
+            if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED) {
+                break;
+            }
+        }
+
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <glad/glad.h>
+#include <cstddef>
+#include <cstdint>
+
+// Ring buffer for streaming dynamic geometry to the GPU.
+// The ring is split into kNumSegments segments, each frame writes into its own segment
+// so we never touch memory the GPU might still be reading.
+// When GL_ARB_buffer_storage is available the whole buffer is persistently mapped once
+// and guarded by fences, otherwise we fall back to orphaning + unsynchronized mapping.
+class StreamBuffer {
+public:
+    static const size_t kNumSegments = 3;
+
+    StreamBuffer();
+    ~StreamBuffer();
+
+    bool        Create(const GLenum target, const size_t segmentSize);
+    void        Destroy();
+    // grows the segments to at least `minSegmentSize` bytes, returns true if the buffer was recreated
+    // the GL buffer changes then, so anything referencing it (e.g. a vao) has to be set up again
+    bool        Reserve(const size_t minSegmentSize);
+
+    // returns pointer to at least `minSize` bytes of writable memory, aligned to `alignment`
+    void*       Map(const size_t minSize, const size_t alignment);
+    // finishes writing `size` bytes into the mapped memory, returns their offset in the buffer
+    size_t      Commit(const size_t size);
+    // fences current segment and moves to the next one, call once per frame
+    void        EndFrame();
+
+    GLuint      GetBuffer() const;
+    size_t      GetSegmentSize() const;
+    bool        IsPersistent() const;
+    bool        IsMapped() const;
+
+private:
+    void        NextSegment();
+    void        WaitSegment(const size_t segment);
+
+private:
+    GLenum      mTarget;
+    GLuint      mBuffer;
+    size_t      mSegmentSize;
+    size_t      mSegment;
+    size_t      mCursor;
+    bool        mPersistent;
+    uint8_t*    mPersistentData;
+    uint8_t*    mMappedData;
+    GLsync      mFences[kNumSegments];
+};
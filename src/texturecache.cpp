@@ -0,0 +1,302 @@
+#include "texturecache.h"
+#include "textureupload.h"
+#include "utils.h"
+
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <utility>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+// bump when the file layout changes
+static const uint32_t kTextureFileMagic   = 0x5443504D; // 'MPCT'
+static const uint32_t kTextureFileVersion = 1;
+
+struct TextureFileHeader {
+    uint32_t    magic;
+    uint32_t    version;
+    uint64_t    key;            // path & levels, entries of colliding keys simply replace each other
+    uint64_t    sourceSize;
+    int64_t     sourceTime;
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    comp;
+    uint32_t    numLevels;
+    uint64_t    payloadSize;    // the levels follow the header
+};
+
+
+static uint64_t FNV1A_Hash64(const void* data, const size_t length, uint64_t hash = 0xcbf29ce484222325ull) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static uint64_t CalcEntryKey(const std::string& fileName, const uint32_t skipLevels, const bool mipmaps) {
+    const uint32_t levels[2] = { skipLevels, mipmaps ? 1u : 0u };
+    // the terminating zero keeps the path apart from the levels
+    uint64_t hash = FNV1A_Hash64(fileName.c_str(), fileName.length() + 1);
+    return FNV1A_Hash64(levels, sizeof(levels), hash);
+}
+
+static bool GetSourceInfo(const std::string& fileName, uint64_t& size, int64_t& time) {
+#ifdef _WIN32
+    struct __stat64 st;
+    if (_stat64(fileName.c_str(), &st) != 0) {
+        return false;
+    }
+#else
+    struct stat st;
+    if (stat(fileName.c_str(), &st) != 0) {
+        return false;
+    }
+#endif
+    size = static_cast<uint64_t>(st.st_size);
+    time = static_cast<int64_t>(st.st_mtime);
+    return true;
+}
+
+static void MakeDirectory(const std::string& path) {
+#ifdef _WIN32
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+}
+
+
+MappedFile::MappedFile()
+    : mData(nullptr)
+    , mSize(0)
+#ifdef _WIN32
+    , mFile(nullptr)
+    , mMapping(nullptr)
+#endif
+{
+}
+MappedFile::MappedFile(MappedFile&& other)
+    : MappedFile()
+{
+    *this = std::move(other);
+}
+MappedFile& MappedFile::operator=(MappedFile&& other) {
+    if (this != &other) {
+        this->Close();
+
+        mData = other.mData;
+        mSize = other.mSize;
+        other.mData = nullptr;
+        other.mSize = 0;
+#ifdef _WIN32
+        mFile = other.mFile;
+        mMapping = other.mMapping;
+        other.mFile = nullptr;
+        other.mMapping = nullptr;
+#endif
+    }
+    return *this;
+}
+MappedFile::~MappedFile() {
+    this->Close();
+}
+
+bool MappedFile::Open(const std::string& fileName) {
+    this->Close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    HANDLE mapping = nullptr;
+    const void* data = nullptr;
+    // empty files can't be mapped
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping) {
+            data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+    }
+    if (!data) {
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        return false;
+    }
+
+    mFile = file;
+    mMapping = mapping;
+    mSize = static_cast<size_t>(size.QuadPart);
+#else
+    const int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    // the mapping keeps the file alive on its own
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    mSize = static_cast<size_t>(st.st_size);
+#endif
+
+    mData = reinterpret_cast<const uint8_t*>(data);
+    return true;
+}
+
+void MappedFile::Close() {
+    if (mData) {
+#ifdef _WIN32
+        UnmapViewOfFile(mData);
+        CloseHandle(mMapping);
+        CloseHandle(mFile);
+        mMapping = nullptr;
+        mFile = nullptr;
+#else
+        munmap(const_cast<uint8_t*>(mData), mSize);
+#endif
+        mData = nullptr;
+        mSize = 0;
+    }
+}
+
+const uint8_t* MappedFile::GetData() const {
+    return mData;
+}
+
+size_t MappedFile::GetSize() const {
+    return mSize;
+}
+
+
+TextureDiskCache::TextureDiskCache() {
+}
+TextureDiskCache::~TextureDiskCache() {
+}
+
+void TextureDiskCache::SetDirectory(const std::string& dir) {
+    mDirectory = dir;
+    if (!mDirectory.empty()) {
+        MakeDirectory(mDirectory);
+    }
+}
+
+const std::string& TextureDiskCache::GetDirectory() const {
+    return mDirectory;
+}
+
+bool TextureDiskCache::Load(const std::string& fileName, const uint32_t skipLevels, const bool mipmaps, Texture& texture, MappedFile& file) const {
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (mDirectory.empty() || !GetSourceInfo(fileName, sourceSize, sourceTime)) {
+        return false;
+    }
+
+    const uint64_t key = CalcEntryKey(fileName, skipLevels, mipmaps);
+    if (!file.Open(this->GetEntryPath(key)) || file.GetSize() < sizeof(TextureFileHeader)) {
+        file.Close();
+        return false;
+    }
+
+    TextureFileHeader header;
+    memcpy(&header, file.GetData(), sizeof(header));
+
+    const bool valid = header.magic == kTextureFileMagic &&
+                       header.version == kTextureFileVersion &&
+                       header.key == key &&
+                       header.sourceSize == sourceSize &&
+                       header.sourceTime == sourceTime &&
+                       header.comp >= 1 && header.comp <= 4 &&
+                       header.numLevels >= 1 && header.numLevels <= 32 &&
+                       header.payloadSize == TextureUploadQueue::CalcLevelsSize(header.width, header.height, header.numLevels, header.comp) &&
+                       header.payloadSize == file.GetSize() - sizeof(header);
+    if (!valid) {
+        file.Close();
+        return false;
+    }
+
+    texture.pixels = file.GetData() + sizeof(header);
+    texture.width = header.width;
+    texture.height = header.height;
+    texture.comp = header.comp;
+    texture.numLevels = header.numLevels;
+    return true;
+}
+
+void TextureDiskCache::Store(const std::string& fileName, const uint32_t skipLevels, const bool mipmaps, const Texture& texture) const {
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (mDirectory.empty() || !GetSourceInfo(fileName, sourceSize, sourceTime)) {
+        return;
+    }
+
+    TextureFileHeader header;
+    header.magic = kTextureFileMagic;
+    header.version = kTextureFileVersion;
+    header.key = CalcEntryKey(fileName, skipLevels, mipmaps);
+    header.sourceSize = sourceSize;
+    header.sourceTime = sourceTime;
+    header.width = texture.width;
+    header.height = texture.height;
+    header.comp = texture.comp;
+    header.numLevels = texture.numLevels;
+    header.payloadSize = TextureUploadQueue::CalcLevelsSize(texture.width, texture.height, texture.numLevels, texture.comp);
+
+    // nobody may map a half written entry, thread ids repeat across processes, so the process id goes in too
+    const std::string path = this->GetEntryPath(header.key);
+#ifdef _WIN32
+    const unsigned long long processId = static_cast<unsigned long long>(_getpid());
+#else
+    const unsigned long long processId = static_cast<unsigned long long>(getpid());
+#endif
+    char suffix[48] = { 0 };
+    snprintf(suffix, sizeof(suffix), ".%llx.%016llx", processId, static_cast<unsigned long long>(std::hash<std::thread::id>()(std::this_thread::get_id())));
+    const std::string tempPath = path + suffix;
+
+    FILE* f = my_fopen(tempPath.c_str(), "wb");
+    if (!f) {
+        return;
+    }
+
+    const bool written = fwrite(&header, sizeof(header), 1, f) == 1 &&
+                         fwrite(texture.pixels, 1, static_cast<size_t>(header.payloadSize), f) == header.payloadSize;
+    const bool closed = fclose(f) == 0;
+
+    // an entry that's in use can't be replaced on Windows, whoever has it keeps the old one then
+    if (!written || !closed || (rename(tempPath.c_str(), path.c_str()) != 0 &&
+                                (remove(path.c_str()) != 0 || rename(tempPath.c_str(), path.c_str()) != 0))) {
+        remove(tempPath.c_str());
+    }
+}
+
+std::string TextureDiskCache::GetEntryPath(const uint64_t key) const {
+    char name[32] = { 0 };
+    snprintf(name, sizeof(name), "%016llx.tex", static_cast<unsigned long long>(key));
+    return mDirectory + "/" + name;
+}
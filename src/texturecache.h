@@ -0,0 +1,64 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read only view of a whole file, mapped into memory till Close or destruction.
+class MappedFile {
+public:
+    MappedFile();
+    MappedFile(MappedFile&& other);
+    MappedFile& operator=(MappedFile&& other);
+    ~MappedFile();
+
+    bool            Open(const std::string& fileName);
+    void            Close();
+
+    const uint8_t*  GetData() const;
+    size_t          GetSize() const;
+
+private:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+private:
+    const uint8_t*  mData;
+    size_t          mSize;
+#ifdef _WIN32
+    void*           mFile;
+    void*           mMapping;
+#endif
+};
+
+// Decoded texture levels kept on disk, so reloading a movie maps its textures instead of
+// decoding the images again. An entry is keyed by the source path and the levels it was decoded
+// for, it's only valid for the source size & modification time it was made from, a changed
+// source misses and its entry is rewritten. Entries are written to a temporary file and renamed,
+// so several threads (or viewers) may share the directory.
+class TextureDiskCache {
+public:
+    struct Texture {
+        const uint8_t*  pixels;     // all levels back to back, tightly packed
+        uint32_t        width;      // of level 0
+        uint32_t        height;
+        uint32_t        comp;
+        uint32_t        numLevels;
+    };
+
+    TextureDiskCache();
+    ~TextureDiskCache();
+
+    // empty (the default) disables the cache
+    void                SetDirectory(const std::string& dir);
+    const std::string&  GetDirectory() const;
+
+    // the pixels stay valid as long as `file` keeps the entry mapped
+    bool                Load(const std::string& fileName, const uint32_t skipLevels, const bool mipmaps, Texture& texture, MappedFile& file) const;
+    void                Store(const std::string& fileName, const uint32_t skipLevels, const bool mipmaps, const Texture& texture) const;
+
+private:
+    std::string         GetEntryPath(const uint64_t key) const;
+
+private:
+    std::string         mDirectory;
+};
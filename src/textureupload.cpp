@@ -0,0 +1,179 @@
+#include "textureupload.h"
+#include "glstatecache.h"
+
+#include <algorithm>
+#include <cstring>
+
+// GL_UNPACK_ALIGNMENT is left at its default, so staged rows are padded to it
+static const size_t kUnpackAlignment = 4;
+
+static size_t CalcRowPitch(const size_t rowSize) {
+    return (rowSize + kUnpackAlignment - 1) / kUnpackAlignment * kUnpackAlignment;
+}
+
+
+TextureUploadQueue::TextureUploadQueue()
+    : mFrameBudget(0)
+    , mQueuedBytes(0)
+    , mLastUploadedBytes(0)
+{
+}
+TextureUploadQueue::~TextureUploadQueue() {
+    this->Destroy();
+}
+
+bool TextureUploadQueue::Create(const size_t frameBudget) {
+    this->Destroy();
+
+    mFrameBudget = std::max<size_t>(frameBudget, kUnpackAlignment);
+    // no vao is affected by this target, so it can be created at any time
+    return mStream.Create(GL_PIXEL_UNPACK_BUFFER, mFrameBudget);
+}
+
+void TextureUploadQueue::Destroy() {
+    mStream.Destroy();
+    mQueue.clear();
+    mCompleted.clear();
+    mQueuedBytes = 0;
+    mLastUploadedBytes = 0;
+}
+
+void TextureUploadQueue::SetFrameBudget(const size_t frameBudget) {
+    // the ring grows on the next Update, it's never shrunk
+    mFrameBudget = std::max<size_t>(frameBudget, kUnpackAlignment);
+}
+
+size_t TextureUploadQueue::GetFrameBudget() const {
+    return mFrameBudget;
+}
+
+size_t TextureUploadQueue::CalcLevelsSize(const uint32_t width, const uint32_t height, const uint32_t numLevels, const uint32_t bytesPerPixel) {
+    size_t size = 0;
+    for (uint32_t level = 0; level < numLevels; ++level) {
+        size += static_cast<size_t>(CalcLevelSize(width, level)) * CalcLevelSize(height, level) * bytesPerPixel;
+    }
+    return size;
+}
+
+uint32_t TextureUploadQueue::CalcLevelSize(const uint32_t size, const uint32_t level) {
+    return std::max<uint32_t>(size >> level, 1);
+}
+
+void TextureUploadQueue::Push(const Upload& upload) {
+    const GLsizei width = static_cast<GLsizei>(upload.width);
+    const GLsizei height = static_cast<GLsizei>(upload.height);
+    const GLsizei numLevels = static_cast<GLsizei>(upload.numLevels);
+
+    GLStateCache::Instance().BindTexture(0, upload.texture);
+    if (GLAD_GL_ARB_texture_storage) {
+        glTexStorage2D(GL_TEXTURE_2D, numLevels, upload.internalFormat, width, height);
+    } else {
+        // no pixels to read, so a bound unpack buffer wouldn't matter either
+        for (GLint level = 0; level < numLevels; ++level) {
+            glTexImage2D(GL_TEXTURE_2D, level, static_cast<GLint>(upload.internalFormat),
+                         std::max(width >> level, 1), std::max(height >> level, 1), 0, upload.format, GL_UNSIGNED_BYTE, nullptr);
+        }
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+    GLStateCache::Instance().BindTexture(0, 0);
+
+    mQueue.push_back(upload);
+    mQueue.back().level = 0;
+    mQueue.back().numUploadedRows = 0;
+    mQueue.back().levelOffset = 0;
+    mQueuedBytes += CalcLevelsSize(upload.width, upload.height, upload.numLevels, upload.bytesPerPixel);
+}
+
+const std::vector<TextureUploadQueue::Upload>& TextureUploadQueue::Update() {
+    mCompleted.clear();
+    mLastUploadedBytes = 0;
+
+    if (mQueue.empty() || !mStream.GetBuffer()) {
+        return mCompleted;
+    }
+
+    GLStateCache& stateCache = GLStateCache::Instance();
+
+    // a frame's worth of rows has to fit one segment
+    mStream.Reserve(mFrameBudget);
+
+    size_t budget = mFrameBudget;
+    while (!mQueue.empty()) {
+        Upload& upload = mQueue.front();
+        const uint32_t width = CalcLevelSize(upload.width, upload.level);
+        const uint32_t height = CalcLevelSize(upload.height, upload.level);
+        const size_t rowSize = width * upload.bytesPerPixel;
+        const size_t pitch = CalcRowPitch(rowSize);
+        const size_t rowsLeft = height - upload.numUploadedRows;
+
+        size_t numRows = std::min(rowsLeft, budget / pitch);
+        if (!numRows) {
+            // rows wider than the whole budget still have to go, one per frame
+            if (mLastUploadedBytes) {
+                break;
+            }
+            numRows = 1;
+            mStream.Reserve(pitch);
+        }
+
+        const size_t size = numRows * pitch;
+        uint8_t* staging = reinterpret_cast<uint8_t*>(mStream.Map(size, kUnpackAlignment));
+        if (!staging) {
+            break;
+        }
+
+        const uint8_t* src = upload.pixels + upload.levelOffset + upload.numUploadedRows * rowSize;
+        if (pitch == rowSize) {
+            memcpy(staging, src, size);
+        } else {
+            for (size_t row = 0; row < numRows; ++row) {
+                memcpy(staging + row * pitch, src + row * rowSize, rowSize);
+            }
+        }
+        const size_t offset = mStream.Commit(size);
+
+        stateCache.BindBuffer(GL_PIXEL_UNPACK_BUFFER, mStream.GetBuffer());
+        stateCache.BindTexture(0, upload.texture);
+        glTexSubImage2D(GL_TEXTURE_2D, static_cast<GLint>(upload.level),
+                        0, static_cast<GLint>(upload.numUploadedRows),
+                        static_cast<GLsizei>(width), static_cast<GLsizei>(numRows),
+                        upload.format, GL_UNSIGNED_BYTE, reinterpret_cast<const GLvoid*>(offset));
+
+        upload.numUploadedRows += static_cast<uint32_t>(numRows);
+        mQueuedBytes -= numRows * rowSize;
+        mLastUploadedBytes += size;
+        budget -= std::min(budget, size);
+
+        if (upload.numUploadedRows == height) {
+            upload.levelOffset += height * rowSize;
+            upload.numUploadedRows = 0;
+            ++upload.level;
+        }
+        // the pixels are in the ring now, the caller may release them
+        if (upload.level == upload.numLevels) {
+            mCompleted.push_back(upload);
+            mQueue.pop_front();
+        }
+    }
+
+    if (mLastUploadedBytes) {
+        // anything else unpacking from client memory must not see our buffer
+        stateCache.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        stateCache.BindTexture(0, 0);
+        mStream.EndFrame();
+    }
+
+    return mCompleted;
+}
+
+const std::deque<TextureUploadQueue::Upload>& TextureUploadQueue::GetQueued() const {
+    return mQueue;
+}
+
+size_t TextureUploadQueue::GetQueuedBytes() const {
+    return mQueuedBytes;
+}
+
+size_t TextureUploadQueue::GetLastUploadedBytes() const {
+    return mLastUploadedBytes;
+}
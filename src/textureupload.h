@@ -0,0 +1,66 @@
+#pragma once
+#include <glad/glad.h>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "streambuffer.h"
+
+// Streams texture pixels to the GPU through a ring of pixel unpack buffers (a StreamBuffer),
+// so the driver copies them asynchronously instead of stalling in a client memory glTexImage2D.
+// Push gives the texture its storage (immutable with GL_ARB_texture_storage), Update then sends
+// the rows with glTexSubImage2D, level by level, no more bytes per call than the frame budget, so a burst
+// of big textures is spread over several frames. A texture is complete once Update returns it.
+class TextureUploadQueue {
+public:
+    struct Upload {
+        GLuint          texture;            // bound & set up by the caller, storage is made by Push
+        const uint8_t*  pixels;             // tightly packed rows of all levels, one after another,
+                                            // have to stay valid till the upload completes
+        uint32_t        width;              // of level 0, the others halve it like GL does
+        uint32_t        height;
+        uint32_t        numLevels;
+        uint32_t        bytesPerPixel;
+        GLenum          internalFormat;     // GL_R8, GL_RG8, GL_RGB8 or GL_RGBA8
+        GLenum          format;             // matching GL_RED, GL_RG, GL_RGB or GL_RGBA
+        void*           userData;
+        // progress, kept by the queue
+        uint32_t        level;
+        uint32_t        numUploadedRows;    // of the current level
+        size_t          levelOffset;        // of the current level in pixels
+    };
+
+    // bytes of the tightly packed levels
+    static size_t CalcLevelsSize(const uint32_t width, const uint32_t height, const uint32_t numLevels, const uint32_t bytesPerPixel);
+    static uint32_t CalcLevelSize(const uint32_t size, const uint32_t level);
+
+    TextureUploadQueue();
+    ~TextureUploadQueue();
+
+    bool        Create(const size_t frameBudget);
+    // queued uploads are dropped, GetQueued still lists them till then, so their owner can release them
+    void        Destroy();
+
+    // bytes Update may stage per call, a single row still goes if it's bigger than that
+    void        SetFrameBudget(const size_t frameBudget);
+    size_t      GetFrameBudget() const;
+
+    void        Push(const Upload& upload);
+    // stages & submits rows of the queued textures in order until the budget is used up,
+    // returns the ones that completed, valid till the next call, call once per frame
+    const std::vector<Upload>& Update();
+
+    const std::deque<Upload>& GetQueued() const;
+    size_t      GetQueuedBytes() const;
+    // staged by the last Update
+    size_t      GetLastUploadedBytes() const;
+
+private:
+    StreamBuffer            mStream;
+    std::deque<Upload>      mQueue;
+    std::vector<Upload>     mCompleted;
+    size_t                  mFrameBudget;
+    size_t                  mQueuedBytes;
+    size_t                  mLastUploadedBytes;
+};
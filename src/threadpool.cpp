@@ -0,0 +1,105 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+
+ThreadPool::ThreadPool()
+    : mFunc(nullptr)
+    , mCount(0)
+    , mNextItem(0)
+    , mNumBusyWorkers(0)
+    , mJobIdx(0)
+    , mQuit(false)
+{
+}
+ThreadPool::~ThreadPool() {
+    this->Shutdown();
+}
+
+void ThreadPool::Initialize(const size_t numThreads) {
+    this->Shutdown();
+
+    size_t total = numThreads ? numThreads : static_cast<size_t>(std::thread::hardware_concurrency());
+    total = std::max<size_t>(total, 1);
+
+    mQuit = false;
+    // the calling thread is one of them
+    for (size_t i = 1; i < total; ++i) {
+        mWorkers.emplace_back(&ThreadPool::WorkerLoop, this);
+    }
+}
+
+void ThreadPool::Shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQuit = true;
+    }
+    mWakeCondition.notify_all();
+
+    for (std::thread& worker : mWorkers) {
+        worker.join();
+    }
+    mWorkers.clear();
+}
+
+size_t ThreadPool::GetNumThreads() const {
+    return mWorkers.size() + 1;
+}
+
+void ThreadPool::ParallelFor(const size_t count, const ItemFunc& func) {
+    // not worth waking anybody up
+    if (mWorkers.empty() || count < 2) {
+        for (size_t i = 0; i < count; ++i) {
+            func(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFunc = &func;
+        mCount = count;
+        mNextItem = 0;
+        mNumBusyWorkers = mWorkers.size();
+        ++mJobIdx;
+    }
+    mWakeCondition.notify_all();
+
+    this->RunItems();
+
+    // the items are all taken by now, but workers may still be finishing theirs
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDoneCondition.wait(lock, [this]() { return mNumBusyWorkers == 0; });
+    mFunc = nullptr;
+}
+
+void ThreadPool::WorkerLoop() {
+    uint64_t lastJobIdx = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWakeCondition.wait(lock, [this, lastJobIdx]() { return mQuit || mJobIdx != lastJobIdx; });
+            if (mQuit) {
+                return;
+            }
+            lastJobIdx = mJobIdx;
+        }
+
+        this->RunItems();
+
+        bool lastOne = false;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            lastOne = (--mNumBusyWorkers == 0);
+        }
+        if (lastOne) {
+            mDoneCondition.notify_one();
+        }
+    }
+}
+
+void ThreadPool::RunItems() {
+    for (size_t i = mNextItem++; i < mCount; i = mNextItem++) {
+        (*mFunc)(i);
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "singleton.h"
+
+// Small fork-join pool for the CPU side of the rendering.
+// ParallelFor hands out items to the workers and the calling thread, one at a time,
+// so uneven items (meshes of very different sizes) still balance well.
+// Only one ParallelFor may run at a time, it's meant to be called from a single thread.
+DECLARE_SINGLETON(ThreadPool) {
+public:
+    typedef std::function<void(const size_t idx)> ItemFunc;
+
+    ThreadPool();
+    ~ThreadPool();
+
+    // numThreads counts the calling thread too, 0 means one per hardware thread
+    void        Initialize(const size_t numThreads = 0);
+    void        Shutdown();
+
+    // including the calling thread, 1 before Initialize
+    size_t      GetNumThreads() const;
+
+    // calls func for every item in [0, count), returns once all of them are done
+    void        ParallelFor(const size_t count, const ItemFunc& func);
+
+private:
+    void        WorkerLoop();
+    void        RunItems();
+
+private:
+    std::vector<std::thread>    mWorkers;
+    std::mutex                  mMutex;
+    std::condition_variable     mWakeCondition;
+    std::condition_variable     mDoneCondition;
+
+    // current job, protected by mMutex apart from the item counter
+    const ItemFunc*             mFunc;
+    size_t                      mCount;
+    std::atomic<size_t>         mNextItem;
+    size_t                      mNumBusyWorkers;
+    uint64_t                    mJobIdx;
+    bool                        mQuit;
+};
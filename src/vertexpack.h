@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "drawlist.h"
+
+// Kernels that pack mesh streams into DrawVertex arena.
+// Everything that is constant across the mesh lives in its DrawData, so per vertex
+// we only read positions and uvs and quantize the uvs to unorm16 within the draw's uv rect.
+// All kernels produce identical output, PackVertices uses SSE2 where available, picked at startup.
+struct VertexPackSource {
+    const float*    positions;  // 3 floats per vertex, z is dropped
+    const float*    uv;         // 2 floats per vertex
+    float           uvRect[4];  // min.xy, extent.xy, as computed by CalcUVRect
+    uint32_t        drawId;
+};
+
+enum class VertexPackKernel : uint8_t {
+    Scalar,
+    SSE2,
+    AVX2,
+
+    Count
+};
+
+typedef void (*VertexPackFunc)(DrawVertex* dst, const VertexPackSource& src, const size_t count);
+
+void                PackVertices(DrawVertex* dst, const VertexPackSource& src, const size_t count);
+// bounding rect of `count` uv pairs, the quantization range for PackVertices
+void                CalcUVRect(const float* uv, const size_t count, float rect[4]);
+
+VertexPackKernel    GetVertexPackKernel();
+bool                IsVertexPackKernelSupported(const VertexPackKernel kernel);
+// direct access to a particular kernel, for benchmarks, nullptr if not supported
+VertexPackFunc      GetVertexPackFunc(const VertexPackKernel kernel);
+const char*         GetVertexPackKernelName(const VertexPackKernel kernel);
@@ -15,6 +15,9 @@ extern "C" {
 #include <chrono>
 
 #include "movie_resmgr.h"
+#include "shadercache.h"
+#include "glstatecache.h"
+#include "threadpool.h"
 #include "movie.h"
 #include "composition.h"
 
@@ -336,8 +339,62 @@ void DoUI() {
     ImGui::Begin("Viewer:", nullptr, kPanelFlags);
     {
         ImGui::Text("%.1f FPS (%.3f ms)", ImGui::GetIO().Framerate, 1000.0f / ImGui::GetIO().Framerate);
+        if (gComposition) {
+            const Composition::DrawStats& stats = gComposition->GetDrawStats();
+            ImGui::Text("Draw calls: %d (meshes: %d, reordered: %d, instanced: %d)", static_cast<int>(stats.numDrawCalls), static_cast<int>(stats.numMeshes), static_cast<int>(stats.numReorderedMeshes), static_cast<int>(stats.numInstancedMeshes));
+            ImGui::Text("Culled: %d (invisible: %d)", static_cast<int>(stats.numCulledMeshes), static_cast<int>(stats.numInvisibleMeshes));
+            ImGui::Text("Uploaded: %.1f KB (reused: %.1f KB)", static_cast<float>(stats.uploadedBytes) / 1024.0f, static_cast<float>(stats.reusedBytes) / 1024.0f);
+        }
+        {
+            const GLStateCache::Stats& stateStats = GLStateCache::Instance().GetLastFrameStats();
+            ImGui::Text("GL state calls: %d (filtered: %d)", static_cast<int>(stateStats.numCalls), static_cast<int>(stateStats.numFilteredCalls));
+        }
+        {
+            const ResourcesManager::DecodeStats decodeStats = ResourcesManager::Instance().GetDecodeStats();
+            ImGui::Text("Textures: %d (pending: %d, cached: %d)", static_cast<int>(decodeStats.numRequested), static_cast<int>(ResourcesManager::Instance().GetNumPendingTextures()), static_cast<int>(decodeStats.numCacheHits));
+            ImGui::Text("Decoded in: %.1f ms (serial: %.1f ms)", decodeStats.wallMs, decodeStats.decodeMs);
+            ImGui::Text("Texture upload: %.1f KB", static_cast<float>(ResourcesManager::Instance().GetLastUploadedBytes()) / 1024.0f);
+            int uploadBudgetKB = static_cast<int>(ResourcesManager::Instance().GetUploadBudget() / 1024);
+            if (ImGui::SliderInt("Upload budget (KB)", &uploadBudgetKB, 64, 16384)) {
+                ResourcesManager::Instance().SetUploadBudget(static_cast<size_t>(uploadBudgetKB) * 1024);
+            }
+            bool mipmaps = ResourcesManager::Instance().IsTextureMipmaps();
+            if (ImGui::Checkbox("Texture mipmaps", &mipmaps)) {
+                ResourcesManager::Instance().SetTextureMipmaps(mipmaps);
+            }
+        }
         ImGui::Checkbox("Draw normal", &gUI.showNormal);
         ImGui::Checkbox("Draw wireframe", &gUI.showWireframe);
+        if (gComposition) {
+            bool multiTexture = gComposition->IsMultiTextureBatching();
+            if (ImGui::Checkbox("Multi-texture batching", &multiTexture)) {
+                gComposition->SetMultiTextureBatching(multiTexture);
+            }
+            bool reordering = gComposition->IsDrawReordering();
+            if (ImGui::Checkbox("Draw reordering", &reordering)) {
+                gComposition->SetDrawReordering(reordering);
+            }
+            bool parallelPacking = gComposition->IsParallelPacking();
+            if (ImGui::Checkbox("Parallel packing", &parallelPacking)) {
+                gComposition->SetParallelPacking(parallelPacking);
+            }
+            bool geometryCaching = gComposition->IsGeometryCaching();
+            if (ImGui::Checkbox("Geometry caching", &geometryCaching)) {
+                gComposition->SetGeometryCaching(geometryCaching);
+            }
+            bool instancing = gComposition->IsInstancing();
+            if (ImGui::Checkbox("Instancing", &instancing)) {
+                gComposition->SetInstancing(instancing);
+            }
+            bool culling = gComposition->IsViewportCulling();
+            if (ImGui::Checkbox("Viewport culling", &culling)) {
+                gComposition->SetViewportCulling(culling);
+            }
+            bool unifiedBlending = gComposition->IsUnifiedBlending();
+            if (ImGui::Checkbox("Unified blending", &unifiedBlending)) {
+                gComposition->SetUnifiedBlending(unifiedBlending);
+            }
+        }
         {
             float contentScale = (gComposition == nullptr) ? 1.0f : gComposition->GetContentScale();
             ImGui::Text("Content scale:");
@@ -566,10 +623,32 @@ void DoUI() {
     }
 
     nextY = 0.0f;
-    wndRect = nk_rect(static_cast<float>(kWindowWidth) - rightPanelWidth, nextY, rightPanelWidth, 250.0f);
+    wndRect = nk_rect(static_cast<float>(kWindowWidth) - rightPanelWidth, nextY, rightPanelWidth, 340.0f);
     if (nk_begin(ctx, "Viewer:", wndRect, kPanelFlags)) {
         nk_layout_row_dynamic(ctx, kLabelHeight, 1);
         nk_labelf(ctx, NK_TEXT_LEFT, "%.1f FPS (%.3f ms)", gFpsCounter.fps, 1000.0f / gFpsCounter.fps);
+        if (gComposition) {
+            const Composition::DrawStats& stats = gComposition->GetDrawStats();
+            nk_labelf(ctx, NK_TEXT_LEFT, "Draw calls: %d (meshes: %d, reordered: %d, instanced: %d)", static_cast<int>(stats.numDrawCalls), static_cast<int>(stats.numMeshes), static_cast<int>(stats.numReorderedMeshes), static_cast<int>(stats.numInstancedMeshes));
+            nk_labelf(ctx, NK_TEXT_LEFT, "Culled: %d (invisible: %d)", static_cast<int>(stats.numCulledMeshes), static_cast<int>(stats.numInvisibleMeshes));
+            nk_labelf(ctx, NK_TEXT_LEFT, "Uploaded: %.1f KB (reused: %.1f KB)", static_cast<float>(stats.uploadedBytes) / 1024.0f, static_cast<float>(stats.reusedBytes) / 1024.0f);
+        }
+        {
+            const GLStateCache::Stats& stateStats = GLStateCache::Instance().GetLastFrameStats();
+            nk_labelf(ctx, NK_TEXT_LEFT, "GL state calls: %d (filtered: %d)", static_cast<int>(stateStats.numCalls), static_cast<int>(stateStats.numFilteredCalls));
+        }
+        {
+            const ResourcesManager::DecodeStats decodeStats = ResourcesManager::Instance().GetDecodeStats();
+            nk_labelf(ctx, NK_TEXT_LEFT, "Textures: %d (pending: %d, cached: %d)", static_cast<int>(decodeStats.numRequested), static_cast<int>(ResourcesManager::Instance().GetNumPendingTextures()), static_cast<int>(decodeStats.numCacheHits));
+            nk_labelf(ctx, NK_TEXT_LEFT, "Decoded in: %.1f ms (serial: %.1f ms)", decodeStats.wallMs, decodeStats.decodeMs);
+            nk_labelf(ctx, NK_TEXT_LEFT, "Texture upload: %.1f KB", static_cast<float>(ResourcesManager::Instance().GetLastUploadedBytes()) / 1024.0f);
+            int uploadBudgetKB = static_cast<int>(ResourcesManager::Instance().GetUploadBudget() / 1024);
+            nk_property_int(ctx, "Upload budget (KB)", 64, &uploadBudgetKB, 16384, 64, 64.0f);
+            ResourcesManager::Instance().SetUploadBudget(static_cast<size_t>(uploadBudgetKB) * 1024);
+            int check = ResourcesManager::Instance().IsTextureMipmaps() ? nk_true : nk_false;
+            nk_checkbox_label(ctx, "Texture mipmaps", &check);
+            ResourcesManager::Instance().SetTextureMipmaps(check == nk_true);
+        }
 
         nk_layout_row_dynamic(ctx, kElementHeight, 1);
         {
@@ -582,6 +661,41 @@ void DoUI() {
             nk_checkbox_label(ctx, "Draw wireframe", &check);
             gUI.showWireframe = (check == nk_true);
         }
+        if (gComposition) {
+            int check = gComposition->IsMultiTextureBatching() ? nk_true : nk_false;
+            nk_checkbox_label(ctx, "Multi-texture batching", &check);
+            gComposition->SetMultiTextureBatching(check == nk_true);
+        }
+        if (gComposition) {
+            int check = gComposition->IsDrawReordering() ? nk_true : nk_false;
+            nk_checkbox_label(ctx, "Draw reordering", &check);
+            gComposition->SetDrawReordering(check == nk_true);
+        }
+        if (gComposition) {
+            int check = gComposition->IsParallelPacking() ? nk_true : nk_false;
+            nk_checkbox_label(ctx, "Parallel packing", &check);
+            gComposition->SetParallelPacking(check == nk_true);
+        }
+        if (gComposition) {
+            int check = gComposition->IsGeometryCaching() ? nk_true : nk_false;
+            nk_checkbox_label(ctx, "Geometry caching", &check);
+            gComposition->SetGeometryCaching(check == nk_true);
+        }
+        if (gComposition) {
+            int check = gComposition->IsInstancing() ? nk_true : nk_false;
+            nk_checkbox_label(ctx, "Instancing", &check);
+            gComposition->SetInstancing(check == nk_true);
+        }
+        if (gComposition) {
+            int check = gComposition->IsViewportCulling() ? nk_true : nk_false;
+            nk_checkbox_label(ctx, "Viewport culling", &check);
+            gComposition->SetViewportCulling(check == nk_true);
+        }
+        if (gComposition) {
+            int check = gComposition->IsUnifiedBlending() ? nk_true : nk_false;
+            nk_checkbox_label(ctx, "Unified blending", &check);
+            gComposition->SetUnifiedBlending(check == nk_true);
+        }
 
         {
             float contentScale = (gComposition == nullptr) ? 1.0f : gComposition->GetContentScale();
@@ -832,6 +946,9 @@ int main(int argc, char** argv) {
     gFpsCounter.fps = 0.0f;
 #endif
 
+    ShaderCache::Instance().Initialize("shader_cache");
+    ResourcesManager::Instance().SetTextureCacheDir("texture_cache");
+    ThreadPool::Instance().Initialize();
     ResourcesManager::Instance().Initialize();
 
     if (!gMovieFilePath.empty() && !gLicenseHash.empty()) {
@@ -844,6 +961,15 @@ int main(int argc, char** argv) {
     while (!glfwWindowShouldClose(window) && !gUI.shouldExit) {
         glfwPollEvents();
 
+        GLStateCache::Instance().BeginFrame();
+
+        // the scale is only known after loading, textures already decoded bigger than needed are redone
+        if (gComposition) {
+            ResourcesManager::Instance().SetTextureScaleHint(gComposition->GetContentScale());
+        }
+        // textures decoded since the last frame replace their white placeholders
+        ResourcesManager::Instance().UpdatePendingTextures();
+
         glClearColor(gBackgroundColor[0], gBackgroundColor[1], gBackgroundColor[2], 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
 
@@ -894,6 +1020,8 @@ int main(int argc, char** argv) {
     }
 
     ShutdownMovie();
+    ShaderCache::Instance().Shutdown();
+    ThreadPool::Instance().Shutdown();
 
 #if (UI_SYSTEM == UI_SYSTEM_IMGUI)
     ImGui_ImplGlfwGL3_Shutdown();